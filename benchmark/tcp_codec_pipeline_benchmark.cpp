@@ -0,0 +1,217 @@
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <asio.hpp>
+
+#include <tcp/internal/tcp_codec_pipeline.hpp>
+
+using gsio::tcp::internal::CodecPipeline;
+using gsio::tcp::internal::FrameCodec;
+using gsio::tcp::internal::FrameCodecOption;
+using gsio::tcp::internal::LengthPrefixDecoder;
+using gsio::tcp::internal::LengthPrefixEncoder;
+using gsio::tcp::internal::MakeCodecPipeline;
+using gsio::tcp::internal::SendPieces;
+using gsio::tcp::internal::TcpSession;
+
+// per message cost of the data path, in memory without sockets:
+// framing -> strip the 1 byte message type -> dispatch, as a hand-written data handler,
+// as CodecPipeline behind one DataHandler, and as one std::function per stage
+// encode: length header in front of a payload, hand-written vs CodecPipeline
+// build with -DCMAKE_BUILD_TYPE=Release, usage: tcp_codec_pipeline_benchmark [messageCount]
+size_t messageCount = 10000000;
+const size_t PayloadSize = 32;
+
+// the stages get a real session over a loopback connection, its io_context never runs,
+// so nothing is received or sent and the calls below stay in this thread
+struct LoopbackSession
+{
+	asio::io_context ioContext;
+	asio::ip::tcp::socket peer;
+	TcpSession::Ptr session;
+
+	LoopbackSession()
+		: peer(ioContext)
+	{
+		asio::ip::tcp::acceptor acceptor(ioContext,
+			asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+		asio::ip::tcp::socket socket(ioContext);
+		socket.connect(acceptor.local_endpoint());
+		acceptor.accept(peer);
+		session = TcpSession::Make(std::move(socket), 64 * 1024, nullptr, nullptr);
+	}
+};
+
+struct Dispatcher
+{
+	uint64_t messages = 0;
+	uint64_t checksum = 0;
+
+	void onMessage(uint8_t type, const char* data, size_t size)
+	{
+		messages++;
+		checksum += type + static_cast<unsigned char>(data[size - 1]);
+	}
+};
+
+FrameCodecOption codecOption()
+{
+	FrameCodecOption option;
+	option.headerSize = 4;
+	return option;
+}
+
+std::string makeInput()
+{
+	std::string input;
+	input.reserve(messageCount * (4 + PayloadSize));
+	const std::string payload(PayloadSize, 'p');
+	for (size_t i = 0; i < messageCount; i++)
+	{
+		const auto header = FrameCodec::header(codecOption(), PayloadSize);
+		input.append(header.data(), 4);
+		input.push_back(static_cast<char>(i & 0x7f));
+		input.append(payload, 1, PayloadSize - 1);
+	}
+	return input;
+}
+
+// feeds the input in 64KB reads like a socket would
+template<typename Handler>
+void runDecode(const char* name, const std::string& input, Handler& handler, Dispatcher& dispatcher)
+{
+	LoopbackSession loopback;
+	const size_t ReadSize = 64 * 1024;
+	std::string buffer;
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t offset = 0; offset < input.size(); offset += ReadSize)
+	{
+		buffer.append(input, offset, ReadSize);
+		const auto procLen = handler(loopback.session, buffer.data(), buffer.size());
+		buffer.erase(0, procLen);
+	}
+	const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << name << ": " << seconds * 1e9 / dispatcher.messages << " ns/msg"
+		<< " (" << dispatcher.messages << " msgs, checksum " << dispatcher.checksum << ")" << std::endl;
+}
+
+void benchDecode()
+{
+	const auto input = makeInput();
+
+	{
+		Dispatcher dispatcher;
+		TcpSession::DataHandler handler = [&dispatcher](TcpSession::Ptr, const char* data, size_t size)
+		{
+			size_t consumed = 0;
+			while (size - consumed >= 4)
+			{
+				const auto length = FrameCodec::readLength(codecOption(), data + consumed);
+				if (size - consumed - 4 < length)
+				{
+					break;
+				}
+				const auto frame = data + consumed + 4;
+				dispatcher.onMessage(static_cast<uint8_t>(frame[0]), frame + 1, length - 1);
+				consumed += 4 + length;
+			}
+			return consumed;
+		};
+		runDecode("decode hand-written   ", input, handler, dispatcher);
+	}
+
+	{
+		Dispatcher dispatcher;
+		TcpSession::DataHandler handler = MakeCodecPipeline(
+			LengthPrefixDecoder(codecOption()),
+			[](const TcpSession::Ptr& session, const char* data, size_t size, auto& next)
+			{
+				next(session, static_cast<uint8_t>(data[0]), data + 1, size - 1);
+			},
+			[&dispatcher](const TcpSession::Ptr&, uint8_t type, const char* data, size_t size)
+			{
+				dispatcher.onMessage(type, data, size);
+			});
+		runDecode("decode CodecPipeline  ", input, handler, dispatcher);
+	}
+
+	{
+		Dispatcher dispatcher;
+		std::function<void(const TcpSession::Ptr&, uint8_t, const char*, size_t)> dispatch =
+			[&dispatcher](const TcpSession::Ptr&, uint8_t type, const char* data, size_t size)
+		{
+			dispatcher.onMessage(type, data, size);
+		};
+		std::function<void(const TcpSession::Ptr&, const char*, size_t)> stripType =
+			[&dispatch](const TcpSession::Ptr& session, const char* data, size_t size)
+		{
+			dispatch(session, static_cast<uint8_t>(data[0]), data + 1, size - 1);
+		};
+		TcpSession::DataHandler handler = [&stripType](TcpSession::Ptr session, const char* data, size_t size)
+		{
+			auto oversized = false;
+			return FrameCodec::decode(codecOption(), data, size, [&](const char* frame, size_t frameSize)
+			{
+				stripType(session, frame, frameSize);
+			}, oversized);
+		};
+		runDecode("decode std::function  ", input, handler, dispatcher);
+	}
+}
+
+void benchEncode()
+{
+	const auto payload = std::make_shared<std::string>(PayloadSize, 'p');
+	uint64_t bytes = 0;
+
+	{
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < messageCount; i++)
+		{
+			auto msg = std::make_shared<std::string>();
+			msg->reserve(4 + payload->size());
+			const auto header = FrameCodec::header(codecOption(), payload->size());
+			msg->append(header.data(), 4);
+			msg->append(*payload);
+			bytes += msg->size();
+		}
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "encode hand-written   : " << seconds * 1e9 / messageCount << " ns/msg" << std::endl;
+	}
+
+	{
+		LoopbackSession loopback;
+		auto pipeline = MakeCodecPipeline(
+			LengthPrefixEncoder(codecOption()),
+			[&bytes](const TcpSession::Ptr&, const SendPieces& pieces, TcpSession::SendOwner)
+			{
+				bytes += pieces.bytes();
+			});
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < messageCount; i++)
+		{
+			pipeline(loopback.session, SendPieces(asio::buffer(*payload)), payload);
+		}
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "encode CodecPipeline  : " << seconds * 1e9 / messageCount << " ns/msg" << std::endl;
+	}
+
+	std::cout << "(" << bytes << " bytes encoded)" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1)
+	{
+		messageCount = std::stoul(argv[1]);
+	}
+
+	benchDecode();
+	benchEncode();
+	return 0;
+}
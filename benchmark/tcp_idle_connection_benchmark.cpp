@@ -0,0 +1,110 @@
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <asio.hpp>
+
+#include <tcp/internal/tcp_session.hpp>
+
+using gsio::tcp::internal::TcpSession;
+using gsio::tcp::internal::TcpSessionOption;
+
+// RSS per idle connection with a posted receive (default) vs recvOnReadable
+// every connection gets one burst first, so the receive buffer has grown like on a real connection,
+// then all of them stay idle, client sockets are in the same process and counted as well
+// usage: tcp_idle_connection_benchmark [connections] [burstKB] [both|posted|readable]
+const size_t MaxRecvBufferSize = 64 * 1024;
+size_t connectionCount = 4096;
+size_t burstBytes = 16 * 1024;
+
+size_t residentBytes()
+{
+	size_t pages = 0;
+	size_t resident = 0;
+	std::ifstream("/proc/self/statm") >> pages >> resident;
+	return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+void runCase(bool recvOnReadable)
+{
+	asio::io_context ioContext(1);
+	auto worker = asio::make_work_guard(ioContext);
+	std::thread ioThread([&ioContext]() { ioContext.run(); });
+
+	asio::ip::tcp::acceptor acceptor(ioContext,
+		asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	acceptor.listen(asio::socket_base::max_listen_connections);
+
+	TcpSessionOption option;
+	option.recvOnReadable = recvOnReadable;
+
+	std::atomic<size_t> received{ 0 };
+	std::vector<asio::ip::tcp::socket> clients;
+	std::vector<TcpSession::Ptr> sessions;
+	clients.reserve(connectionCount);
+
+	const auto before = residentBytes();
+	const std::string burst(burstBytes, 'x');
+	for (size_t i = 0; i < connectionCount; i++)
+	{
+		clients.emplace_back(ioContext);
+		clients.back().connect(acceptor.local_endpoint());
+		asio::ip::tcp::socket serverSocket(ioContext);
+		acceptor.accept(serverSocket);
+		sessions.push_back(TcpSession::Make(std::move(serverSocket), MaxRecvBufferSize,
+			[&received](TcpSession::Ptr, const char*, size_t len)
+			{
+				received += len;
+				return len;
+			}, nullptr, option));
+		asio::write(clients.back(), asio::buffer(burst));
+	}
+	while (received.load() < connectionCount * burstBytes)
+	{
+		std::this_thread::yield();
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	const auto idle = residentBytes();
+
+	std::cout << (recvOnReadable ? "recvOnReadable" : "posted receive")
+		<< ": " << (idle - before) / connectionCount << " B/conn RSS" << std::endl;
+
+	for (auto& session : sessions)
+	{
+		session->postClose();
+	}
+	ioContext.stop();
+	ioThread.join();
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1)
+	{
+		connectionCount = std::stoul(argv[1]);
+	}
+	if (argc > 2)
+	{
+		burstBytes = std::stoul(argv[2]) * 1024;
+	}
+
+	// the allocator keeps freed memory, so with both the mode which should use less runs first,
+	// run one mode per process for exact numbers
+	const std::string mode = argc > 3 ? argv[3] : "both";
+	std::cout << connectionCount << " idle connections, " << burstBytes / 1024 << "KB burst each" << std::endl;
+	if (mode != "posted")
+	{
+		runCase(true);
+	}
+	if (mode != "readable")
+	{
+		runCase(false);
+	}
+	return 0;
+}
@@ -0,0 +1,296 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <asio.hpp>
+
+#include <tcp/internal/tcp_session.hpp>
+#include <tcp/internal/tcp_session_group.hpp>
+
+using gsio::tcp::internal::TcpSession;
+using gsio::tcp::internal::TcpSessionGroup;
+using gsio::tcp::internal::TcpSessionOption;
+
+// several threads run one io_context, producer threads send framed messages to a few sessions
+// and a group broadcasts to all of them while the peers stream bytes back,
+// every frame and every received byte is checked, the exit code is non-zero if anything was lost or corrupted
+// frame: 4 bytes length (little endian) | 1 byte producer | 4 bytes sequence | payload
+const size_t IoThreadNum = 4;
+const size_t SessionNum = 4;
+const size_t ProducerNum = 8;
+const size_t FrameHeaderSize = 9;
+const size_t RecvBytesPerSession = 8 * 1024 * 1024;
+size_t messagesPerProducer = 100000;
+size_t broadcastNum = 10000;
+
+uint8_t payloadByte(uint32_t producer, uint32_t seq, size_t i)
+{
+	return static_cast<uint8_t>(producer * 31 + seq * 7 + i);
+}
+
+std::shared_ptr<std::string> makeFrame(uint32_t producer, uint32_t seq)
+{
+	const size_t payloadSize = 1 + (seq * 37 + producer) % 300;
+	auto frame = std::make_shared<std::string>(FrameHeaderSize + payloadSize, '\0');
+	auto data = &(*frame)[0];
+	const uint32_t length = static_cast<uint32_t>(frame->size() - 4);
+	for (size_t i = 0; i < 4; i++)
+	{
+		data[i] = static_cast<char>((length >> (8 * i)) & 0xff);
+		data[5 + i] = static_cast<char>((seq >> (8 * i)) & 0xff);
+	}
+	data[4] = static_cast<char>(producer);
+	for (size_t i = 0; i < payloadSize; i++)
+	{
+		data[FrameHeaderSize + i] = static_cast<char>(payloadByte(producer, seq, i));
+	}
+	return frame;
+}
+
+uint32_t readUint32(const unsigned char* data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+// frames of one session, producer ProducerNum is the group broadcast
+size_t expectedFrames(size_t sessionIndex)
+{
+	size_t frames = broadcastNum;
+	for (size_t n = 0; n < messagesPerProducer; n++)
+	{
+		frames += n % SessionNum == sessionIndex ? ProducerNum : 0;
+	}
+	return frames;
+}
+
+struct Peer
+{
+	asio::ip::tcp::socket socket;
+	TcpSession::Ptr session;
+	std::atomic_size_t recvBytes{ 0 };
+	std::atomic_size_t recvBad{ 0 };
+	size_t frames{ 0 };
+	size_t badFrames{ 0 };
+
+	explicit Peer(asio::io_context& ioContext)
+		: socket(ioContext)
+	{}
+};
+
+// reads and checks every frame until the expected count arrived
+void readFrames(Peer& peer, size_t expected)
+{
+	std::vector<uint32_t> nextSeq(ProducerNum + 1, 0);
+	std::vector<unsigned char> buffer;
+	std::vector<unsigned char> chunk(256 * 1024);
+	size_t pos = 0;
+	while (peer.frames < expected)
+	{
+		const auto n = peer.socket.read_some(asio::buffer(chunk));
+		buffer.insert(buffer.end(), chunk.begin(), chunk.begin() + n);
+		while (buffer.size() - pos >= 4)
+		{
+			const auto length = readUint32(&buffer[pos]);
+			if (length < FrameHeaderSize - 4 || length > 4096)
+			{
+				// the stream is broken, nothing after this can be trusted
+				peer.badFrames += expected - peer.frames;
+				peer.frames = expected;
+				return;
+			}
+			if (buffer.size() - pos < 4 + length)
+			{
+				break;
+			}
+
+			const auto producer = buffer[pos + 4];
+			const auto seq = readUint32(&buffer[pos + 5]);
+			auto good = producer <= ProducerNum && seq == nextSeq[producer];
+			for (size_t i = 0; good && i < length + 4 - FrameHeaderSize; i++)
+			{
+				good = buffer[pos + FrameHeaderSize + i] == payloadByte(producer, seq, i);
+			}
+			if (producer <= ProducerNum)
+			{
+				nextSeq[producer] = seq + 1;
+			}
+			peer.badFrames += good ? 0 : 1;
+			peer.frames++;
+			pos += 4 + length;
+		}
+		if (pos > 1024 * 1024)
+		{
+			buffer.erase(buffer.begin(), buffer.begin() + pos);
+			pos = 0;
+		}
+	}
+}
+
+// streams RecvBytesPerSession bytes in odd sized writes
+void writeBytes(Peer& peer)
+{
+	std::vector<char> chunk(64 * 1024);
+	size_t sent = 0;
+	size_t round = 0;
+	while (sent < RecvBytesPerSession)
+	{
+		const auto size = std::min(RecvBytesPerSession - sent, 1 + (round++ * 7919) % chunk.size());
+		for (size_t i = 0; i < size; i++)
+		{
+			chunk[i] = static_cast<char>((sent + i) % 251);
+		}
+		asio::write(peer.socket, asio::buffer(chunk.data(), size));
+		sent += size;
+	}
+}
+
+bool runCase(const std::string& name, const TcpSessionOption& option)
+{
+	asio::io_context ioContext;
+	auto worker = asio::make_work_guard(ioContext);
+	std::vector<std::thread> ioThreads;
+	for (size_t i = 0; i < IoThreadNum; i++)
+	{
+		ioThreads.emplace_back([&ioContext]() { ioContext.run(); });
+	}
+
+	// the peers use blocking calls only, their context never runs
+	asio::io_context peerContext;
+	asio::ip::tcp::acceptor acceptor(peerContext,
+		asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	auto group = TcpSessionGroup::Make();
+	std::vector<std::unique_ptr<Peer>> peers;
+	for (size_t s = 0; s < SessionNum; s++)
+	{
+		peers.emplace_back(std::make_unique<Peer>(peerContext));
+		auto peer = peers.back().get();
+
+		asio::ip::tcp::socket socket(ioContext);
+		socket.connect(acceptor.local_endpoint());
+		acceptor.accept(peer->socket);
+
+		auto offset = std::make_shared<size_t>(0);
+		peer->session = TcpSession::Make(std::move(socket), 64 * 1024,
+			[peer, offset](TcpSession::Ptr, const char* data, size_t size)
+		{
+			for (size_t i = 0; i < size; i++)
+			{
+				if (static_cast<unsigned char>(data[i]) != (*offset + i) % 251)
+				{
+					peer->recvBad.fetch_add(1, std::memory_order_relaxed);
+					break;
+				}
+			}
+			*offset += size;
+			peer->recvBytes.fetch_add(size, std::memory_order_relaxed);
+			return size;
+		}, nullptr, option);
+		group->join(peer->session);
+	}
+
+	std::vector<std::thread> peerThreads;
+	for (size_t s = 0; s < SessionNum; s++)
+	{
+		auto peer = peers[s].get();
+		const auto expected = expectedFrames(s);
+		peerThreads.emplace_back([peer, expected]() { readFrames(*peer, expected); });
+		peerThreads.emplace_back([peer]() { writeBytes(*peer); });
+	}
+
+	// joins are posted, wait until all of them took effect before the first broadcast
+	while (group->size() < SessionNum)
+	{
+		std::this_thread::yield();
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> producers;
+	for (size_t p = 0; p < ProducerNum; p++)
+	{
+		producers.emplace_back([p, &peers]()
+		{
+			std::vector<uint32_t> seq(SessionNum, 0);
+			for (size_t n = 0; n < messagesPerProducer; n++)
+			{
+				const auto s = n % SessionNum;
+				peers[s]->session->send(makeFrame(static_cast<uint32_t>(p), seq[s]++));
+			}
+		});
+	}
+	producers.emplace_back([&group]()
+	{
+		for (size_t n = 0; n < broadcastNum; n++)
+		{
+			group->broadcast(makeFrame(static_cast<uint32_t>(ProducerNum), static_cast<uint32_t>(n)));
+		}
+	});
+	for (auto& producer : producers)
+	{
+		producer.join();
+	}
+	for (auto& thread : peerThreads)
+	{
+		thread.join();
+	}
+	for (const auto& peer : peers)
+	{
+		while (peer->recvBytes.load() < RecvBytesPerSession)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	size_t frames = 0;
+	size_t badFrames = 0;
+	size_t recvBad = 0;
+	for (const auto& peer : peers)
+	{
+		frames += peer->frames;
+		badFrames += peer->badFrames;
+		recvBad += peer->recvBad.load();
+		peer->session->postClose();
+	}
+	std::cout << name << ": frames=" << frames << " bad=" << badFrames
+		<< " recvBad=" << recvBad << " (" << seconds << "s)" << std::endl;
+
+	worker.reset();
+	ioContext.stop();
+	for (auto& thread : ioThreads)
+	{
+		thread.join();
+	}
+	return badFrames == 0 && recvBad == 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1)
+	{
+		messagesPerProducer = std::stoul(argv[1]);
+	}
+
+	auto ok = runCase("default", TcpSessionOption());
+
+	TcpSessionOption scheduled;
+	scheduled.writeQuantum = 16 * 1024;
+	scheduled.recvOnReadable = true;
+	scheduled.recvDrainBytes = 256 * 1024;
+	ok = runCase("write scheduler, recv on readable", scheduled) && ok;
+
+	TcpSessionOption deferred;
+	deferred.deferSendFlush = true;
+	deferred.sendFlushDelay = std::chrono::microseconds(50);
+	deferred.inlineSend = false;
+	deferred.sendHighWatermarkBytes = 256 * 1024;
+	deferred.sendLowWatermarkBytes = 64 * 1024;
+	ok = runCase("deferred flush", deferred) && ok;
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <malloc.h>
+
+#include <asio.hpp>
+
+#include <tcp/internal/tcp_session.hpp>
+
+using gsio::tcp::internal::AdaptiveRecvBufferSizer;
+using gsio::tcp::internal::TcpSession;
+using gsio::tcp::internal::TcpSessionOption;
+
+// tanh growth (default) vs AdaptiveRecvBufferSizer on loopback connections
+// memory: every connection gets one burst, stays idle for a second and then gets a trickle of small messages,
+// the heap in use per connection is measured after each step (glibc mallinfo2, mmapped chunks included)
+// throughput: one connection receives a continuous stream
+// build with -DCMAKE_BUILD_TYPE=Release, usage: tcp_recv_buffer_benchmark [connections] [burstKB]
+const size_t MaxRecvBufferSize = 4 * 1024 * 1024;
+size_t connectionCount = 256;
+size_t burstBytes = 1024 * 1024;
+
+size_t heapInUse()
+{
+	// large buffers are mmapped chunks, uordblks alone doesn't count them
+	const auto info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+
+TcpSessionOption makeOption(bool adaptive)
+{
+	TcpSessionOption option;
+	if (adaptive)
+	{
+		option.recvBufferSizer = AdaptiveRecvBufferSizer::Factory();
+	}
+	return option;
+}
+
+void waitFor(const std::atomic<size_t>& received, size_t expected)
+{
+	while (received.load() < expected)
+	{
+		std::this_thread::yield();
+	}
+}
+
+void runMemoryCase(bool adaptive)
+{
+	const size_t SmallMessageSize = 64;
+	const size_t SmallMessageRounds = 64;
+
+	asio::io_context ioContext(1);
+	auto worker = asio::make_work_guard(ioContext);
+	std::thread ioThread([&ioContext]() { ioContext.run(); });
+
+	asio::ip::tcp::acceptor acceptor(ioContext,
+		asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+	std::atomic<size_t> received{ 0 };
+	std::vector<asio::ip::tcp::socket> clients;
+	std::vector<TcpSession::Ptr> sessions;
+	clients.reserve(connectionCount);
+
+	const auto before = heapInUse();
+	for (size_t i = 0; i < connectionCount; i++)
+	{
+		clients.emplace_back(ioContext);
+		clients.back().connect(acceptor.local_endpoint());
+		asio::ip::tcp::socket serverSocket(ioContext);
+		acceptor.accept(serverSocket);
+		sessions.push_back(TcpSession::Make(std::move(serverSocket), MaxRecvBufferSize,
+			[&received](TcpSession::Ptr, const char*, size_t len)
+			{
+				received += len;
+				return len;
+			}, nullptr, makeOption(adaptive)));
+	}
+	const auto idle = heapInUse();
+
+	const std::string burst(burstBytes, 'x');
+	for (auto& client : clients)
+	{
+		asio::write(client, asio::buffer(burst));
+	}
+	auto expected = connectionCount * burstBytes;
+	waitFor(received, expected);
+	const auto afterBurst = heapInUse();
+
+	// nothing arrives, every session waits for more
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+	const auto idleAfterBurst = heapInUse();
+
+	// one small message per connection and round, each becomes its own read
+	const std::string small(SmallMessageSize, 'y');
+	for (size_t round = 0; round < SmallMessageRounds; round++)
+	{
+		for (auto& client : clients)
+		{
+			asio::write(client, asio::buffer(small));
+		}
+		expected += connectionCount * SmallMessageSize;
+		waitFor(received, expected);
+	}
+	const auto afterTrickle = heapInUse();
+
+	std::cout << (adaptive ? "adaptive" : "tanh    ")
+		<< ": idle " << (idle - before) / connectionCount << " B/conn"
+		<< ", after burst " << (afterBurst - before) / connectionCount << " B/conn"
+		<< ", idle after burst " << (idleAfterBurst - before) / connectionCount << " B/conn"
+		<< ", after trickle " << (afterTrickle - before) / connectionCount << " B/conn" << std::endl;
+
+	for (auto& session : sessions)
+	{
+		session->postClose();
+	}
+	ioContext.stop();
+	ioThread.join();
+}
+
+void runThroughputCase(bool adaptive)
+{
+	const size_t TotalBytes = size_t(2) * 1024 * 1024 * 1024;
+
+	asio::io_context ioContext(1);
+	auto worker = asio::make_work_guard(ioContext);
+	std::thread ioThread([&ioContext]() { ioContext.run(); });
+
+	asio::ip::tcp::acceptor acceptor(ioContext,
+		asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	asio::ip::tcp::socket client(ioContext);
+	client.connect(acceptor.local_endpoint());
+	asio::ip::tcp::socket serverSocket(ioContext);
+	acceptor.accept(serverSocket);
+
+	std::atomic<size_t> received{ 0 };
+	auto session = TcpSession::Make(std::move(serverSocket), MaxRecvBufferSize,
+		[&received](TcpSession::Ptr, const char*, size_t len)
+		{
+			received += len;
+			return len;
+		}, nullptr, makeOption(adaptive));
+
+	const auto start = std::chrono::steady_clock::now();
+	std::thread producer([&client, TotalBytes]()
+	{
+		const std::string chunk(256 * 1024, 'x');
+		for (size_t sent = 0; sent < TotalBytes; sent += chunk.size())
+		{
+			asio::write(client, asio::buffer(chunk));
+		}
+	});
+	waitFor(received, TotalBytes);
+	const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	producer.join();
+
+	std::cout << (adaptive ? "adaptive" : "tanh    ")
+		<< ": " << received.load() / seconds / 1024 / 1024 << " MB/s" << std::endl;
+
+	session->postClose();
+	ioContext.stop();
+	ioThread.join();
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1)
+	{
+		connectionCount = std::stoul(argv[1]);
+	}
+	if (argc > 2)
+	{
+		burstBytes = std::stoul(argv[2]) * 1024;
+	}
+
+	std::cout << "memory, " << connectionCount << " connections, " << burstBytes / 1024 << "KB burst" << std::endl;
+	runMemoryCase(false);
+	runMemoryCase(true);
+
+	std::cout << "throughput, one connection" << std::endl;
+	runThroughputCase(false);
+	runThroughputCase(true);
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <asio.hpp>
+
+#include <tcp/internal/tcp_session.hpp>
+
+using gsio::tcp::internal::TcpSession;
+
+// N producer threads send to one hot session,
+// a blocking reader on the other side of a loopback connection drains the bytes
+size_t messagesPerProducer = 200000;
+size_t messageSize = 64;
+
+void runCase(size_t producerNum)
+{
+	asio::io_context ioContext(1);
+	auto worker = asio::make_work_guard(ioContext);
+	std::thread ioThread([&ioContext]() { ioContext.run(); });
+
+	asio::ip::tcp::acceptor acceptor(ioContext,
+		asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	asio::ip::tcp::socket clientSocket(ioContext);
+	clientSocket.connect(acceptor.local_endpoint());
+	asio::ip::tcp::socket serverSocket(ioContext);
+	acceptor.accept(serverSocket);
+
+	auto session = TcpSession::Make(std::move(clientSocket), 1024, nullptr, nullptr);
+
+	const size_t totalBytes = producerNum * messagesPerProducer * messageSize;
+	std::thread reader([&serverSocket, totalBytes]()
+	{
+		std::vector<char> buffer(256 * 1024);
+		size_t received = 0;
+		while (received < totalBytes)
+		{
+			received += serverSocket.read_some(asio::buffer(buffer));
+		}
+	});
+
+	const auto msg = std::make_shared<std::string>(messageSize, 'x');
+	std::atomic_bool go{ false };
+	std::vector<std::thread> producers;
+	for (size_t i = 0; i < producerNum; i++)
+	{
+		producers.emplace_back([&go, &session, &msg]()
+		{
+			while (!go.load())
+			{
+				std::this_thread::yield();
+			}
+			for (size_t n = 0; n < messagesPerProducer; n++)
+			{
+				session->send(msg);
+			}
+		});
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	go.store(true);
+	for (auto& producer : producers)
+	{
+		producer.join();
+	}
+	const auto produced = std::chrono::steady_clock::now();
+	reader.join();
+	const auto finished = std::chrono::steady_clock::now();
+
+	const auto produceSeconds = std::chrono::duration<double>(produced - start).count();
+	const auto totalSeconds = std::chrono::duration<double>(finished - start).count();
+	const auto totalMessages = producerNum * messagesPerProducer;
+	std::cout << "producers: " << producerNum
+		<< ", enqueue: " << static_cast<size_t>(totalMessages / produceSeconds) << " msg/s"
+		<< ", delivered: " << static_cast<size_t>(totalMessages / totalSeconds) << " msg/s"
+		<< " (" << totalBytes / totalSeconds / 1024 / 1024 << " MB/s)" << std::endl;
+
+	session->postClose();
+	ioContext.stop();
+	ioThread.join();
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1)
+	{
+		messagesPerProducer = std::stoul(argv[1]);
+	}
+
+	for (const auto producerNum : { 1, 4, 16 })
+	{
+		runCase(producerNum);
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <asio.hpp>
+
+#include <tcp/internal/tcp_session.hpp>
+
+using gsio::tcp::internal::TcpSession;
+using gsio::tcp::internal::TcpSessionOption;
+
+// a session queues more than its high watermark to a peer which doesn't read,
+// then the peer reads in small steps until the low watermark handler fires,
+// the queue must still hold the messages above the low watermark at that point, not be drained completely
+// cases with only the byte or only the message watermark configured, and with both,
+// the exit code is non-zero if a low watermark handler didn't fire in time
+const size_t MessageSize = 64 * 1024;
+const size_t MessageNum = 32;
+
+struct Watermarks
+{
+	size_t highBytes;
+	size_t highMessages;
+	size_t lowBytes;
+	size_t lowMessages;
+};
+
+bool runCase(const std::string& name, const Watermarks& watermarks)
+{
+	asio::io_context ioContext(1);
+	auto worker = asio::make_work_guard(ioContext);
+	std::thread ioThread([&ioContext]() { ioContext.run(); });
+
+	asio::ip::tcp::acceptor acceptor(ioContext,
+		asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	asio::ip::tcp::socket clientSocket(ioContext);
+	clientSocket.connect(acceptor.local_endpoint());
+	asio::ip::tcp::socket serverSocket(ioContext);
+	acceptor.accept(serverSocket);
+	// small kernel buffers, so the queue of the session holds nearly everything
+	clientSocket.set_option(asio::socket_base::send_buffer_size(16 * 1024));
+	serverSocket.set_option(asio::socket_base::receive_buffer_size(16 * 1024));
+
+	TcpSessionOption option;
+	option.sendHighWatermarkBytes = watermarks.highBytes;
+	option.sendHighWatermarkMessages = watermarks.highMessages;
+	option.sendLowWatermarkBytes = watermarks.lowBytes;
+	option.sendLowWatermarkMessages = watermarks.lowMessages;
+	std::atomic_size_t highCalls{ 0 };
+	std::atomic_size_t lowCalls{ 0 };
+	std::atomic_size_t lowBytes{ 0 };
+	std::atomic_size_t lowMessages{ 0 };
+	option.highWatermarkHandler = [&highCalls](TcpSession::Ptr, size_t, size_t)
+	{
+		highCalls++;
+	};
+	option.lowWatermarkHandler = [&lowCalls, &lowBytes, &lowMessages](TcpSession::Ptr, size_t bytes, size_t messages)
+	{
+		lowBytes = bytes;
+		lowMessages = messages;
+		lowCalls++;
+	};
+	auto session = TcpSession::Make(std::move(clientSocket), 1024, nullptr, nullptr, option);
+
+	const auto msg = std::make_shared<std::string>(MessageSize, 'x');
+	for (size_t i = 0; i < MessageNum; i++)
+	{
+		session->send(msg);
+	}
+	while (highCalls.load() == 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	std::vector<char> buffer(4 * 1024);
+	size_t received = 0;
+	while (lowCalls.load() == 0 && received < MessageNum * MessageSize)
+	{
+		received += serverSocket.read_some(asio::buffer(buffer));
+	}
+	const auto start = std::chrono::steady_clock::now();
+	while (lowCalls.load() == 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(1))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	// fired before the queue was empty, with the watched dimensions at their low watermarks
+	const auto ok = highCalls.load() == 1 && lowCalls.load() == 1 && lowMessages.load() > 0 &&
+		(watermarks.highBytes == 0 || lowBytes.load() <= watermarks.lowBytes) &&
+		(watermarks.highMessages == 0 || lowMessages.load() <= watermarks.lowMessages);
+	std::cout << name << ": high=" << highCalls.load() << " low=" << lowCalls.load()
+		<< ", queued at low " << lowBytes.load() << " bytes " << lowMessages.load() << " messages"
+		<< (ok ? "" : " FAILED") << std::endl;
+
+	session->postClose();
+	ioContext.stop();
+	ioThread.join();
+	return ok;
+}
+
+int main()
+{
+	auto ok = runCase("bytes only", Watermarks{ 1024 * 1024, 0, 256 * 1024, 0 });
+	ok = runCase("messages only", Watermarks{ 0, 16, 0, 4 }) && ok;
+	ok = runCase("bytes and messages", Watermarks{ 1024 * 1024, 16, 256 * 1024, 4 }) && ok;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <asio.hpp>
+
+#include <tcp/internal/tcp_session.hpp>
+
+using gsio::tcp::internal::TcpSession;
+using gsio::tcp::internal::TcpSessionOption;
+
+// floods one session with tiny messages, with and without staging-block coalescing
+// build with -DCMAKE_BUILD_TYPE=Release, usage: tcp_small_message_benchmark [messageCount]
+size_t messageCount = 1000000;
+
+void runCase(size_t messageSize, const TcpSessionOption& option, const char* name)
+{
+	asio::io_context ioContext(1);
+	auto worker = asio::make_work_guard(ioContext);
+
+	asio::ip::tcp::acceptor acceptor(ioContext,
+		asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	asio::ip::tcp::socket clientSocket(ioContext);
+	clientSocket.connect(acceptor.local_endpoint());
+	asio::ip::tcp::socket serverSocket(ioContext);
+	acceptor.accept(serverSocket);
+
+	auto session = TcpSession::Make(std::move(clientSocket), 1024, nullptr, nullptr, option);
+
+	const auto msg = std::make_shared<std::string>(messageSize, 'x');
+	// queue everything first, so the flood is drained by the batching stage only
+	for (size_t i = 0; i < messageCount; i++)
+	{
+		session->send(msg);
+	}
+
+	const size_t totalBytes = messageCount * messageSize;
+	const auto start = std::chrono::steady_clock::now();
+	std::thread ioThread([&ioContext]() { ioContext.run(); });
+
+	std::vector<char> buffer(256 * 1024);
+	size_t received = 0;
+	size_t reads = 0;
+	while (received < totalBytes)
+	{
+		received += serverSocket.read_some(asio::buffer(buffer));
+		reads++;
+	}
+	const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << messageSize << " bytes, " << name
+		<< ": " << static_cast<size_t>(messageCount / seconds) << " msg/s"
+		<< " (" << totalBytes / seconds / 1024 / 1024 << " MB/s, "
+		<< reads << " reads)" << std::endl;
+
+	session->postClose();
+	ioContext.stop();
+	ioThread.join();
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1)
+	{
+		messageCount = std::stoul(argv[1]);
+	}
+
+	TcpSessionOption plain;
+	plain.sendCoalesceThreshold = 0;
+	TcpSessionOption coalesce;
+
+	for (const auto messageSize : { 16, 64 })
+	{
+		runCase(messageSize, plain, "one iovec per message");
+		runCase(messageSize, coalesce, "coalesced");
+	}
+	return 0;
+}
@@ -0,0 +1,100 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <asio.hpp>
+
+#include <tcp/internal/tcp_session.hpp>
+
+using gsio::tcp::internal::TcpSession;
+using gsio::tcp::internal::TcpSessionOption;
+
+// copy vs MSG_ZEROCOPY on a loopback connection
+// note the kernel copies loopback traffic anyway and reports it as copied,
+// the numbers are only meaningful for the bookkeeping overhead unless a real NIC is used
+// build with -DCMAKE_BUILD_TYPE=Release, usage: tcp_zerocopy_benchmark [totalMegabytes]
+size_t totalBytes = size_t(1024) * 1024 * 1024;
+
+double cpuSeconds()
+{
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+		(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+void runCase(size_t messageSize, bool zeroCopy)
+{
+	asio::io_context ioContext(1);
+	auto worker = asio::make_work_guard(ioContext);
+	std::thread ioThread([&ioContext]() { ioContext.run(); });
+
+	asio::ip::tcp::acceptor acceptor(ioContext,
+		asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	asio::ip::tcp::socket clientSocket(ioContext);
+	clientSocket.connect(acceptor.local_endpoint());
+	asio::ip::tcp::socket serverSocket(ioContext);
+	acceptor.accept(serverSocket);
+
+	TcpSessionOption option;
+	option.zeroCopyThreshold = zeroCopy ? 1 : 0;
+	auto session = TcpSession::Make(std::move(clientSocket), 1024, nullptr, nullptr, option);
+
+	const auto messageCount = std::max<size_t>(1, totalBytes / messageSize);
+	const auto msg = std::make_shared<std::string>(messageSize, 'x');
+
+	const auto startCpu = cpuSeconds();
+	const auto start = std::chrono::steady_clock::now();
+	std::thread producer([&session, &msg, messageCount]()
+	{
+		// keep at most 32MB queued, so memory doesn't depend on the total size
+		for (size_t i = 0; i < messageCount; i++)
+		{
+			while (session->queuedSendBytes() > 32 * 1024 * 1024)
+			{
+				std::this_thread::yield();
+			}
+			session->send(msg);
+		}
+	});
+
+	std::vector<char> buffer(1024 * 1024);
+	size_t received = 0;
+	while (received < messageCount * messageSize)
+	{
+		received += serverSocket.read_some(asio::buffer(buffer));
+	}
+	producer.join();
+	const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	const auto cpu = cpuSeconds() - startCpu;
+
+	const auto stats = session->zeroCopyStats();
+	std::cout << messageSize / 1024 << "KB, " << (zeroCopy ? "zerocopy" : "copy    ")
+		<< ": " << received / seconds / 1024 / 1024 << " MB/s"
+		<< ", cpu " << cpu / seconds * 100 << "%"
+		<< ", zerocopy calls " << stats.sent << " (copied " << stats.copied << ")" << std::endl;
+
+	session->postClose();
+	ioContext.stop();
+	ioThread.join();
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1)
+	{
+		totalBytes = std::stoul(argv[1]) * 1024 * 1024;
+	}
+
+	for (const auto messageSize : { 64 * 1024, 1024 * 1024, 8 * 1024 * 1024 })
+	{
+		runCase(messageSize, false);
+		runCase(messageSize, true);
+	}
+	return 0;
+}
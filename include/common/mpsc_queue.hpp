@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+
+namespace gsio { namespace common {
+
+	// intrusive hook of MpscQueue, the element type must derive from it
+	struct MpscNode
+	{
+		MpscNode* mpscNext{ nullptr };
+	};
+
+	// lock-free multi-producer / single-consumer queue
+	// producers push with a single CAS and never block,
+	// the consumer takes everything in one exchange and gets it back in FIFO order
+	template<typename T>
+	class MpscQueue
+	{
+	private:
+		std::atomic<MpscNode*> mHead{ nullptr };
+
+	public:
+		MpscQueue() = default;
+		MpscQueue(const MpscQueue&) = delete;
+		MpscQueue& operator=(const MpscQueue&) = delete;
+
+		// returns true if the queue was empty before this push,
+		// that is the only case where the consumer needs to be woken up
+		bool push(T* node) noexcept
+		{
+			MpscNode* hook = node;
+			auto head = mHead.load(std::memory_order_relaxed);
+			do
+			{
+				hook->mpscNext = head;
+			} while (!mHead.compare_exchange_weak(head, hook,
+				std::memory_order_release,
+				std::memory_order_relaxed));
+
+			return head == nullptr;
+		}
+
+		// consumer only
+		// returns the oldest node, the rest are chained by next()
+		T* popAll() noexcept
+		{
+			auto node = mHead.exchange(nullptr, std::memory_order_acquire);
+
+			MpscNode* reversed = nullptr;
+			while (node != nullptr)
+			{
+				auto nextNode = node->mpscNext;
+				node->mpscNext = reversed;
+				reversed = node;
+				node = nextNode;
+			}
+
+			return static_cast<T*>(reversed);
+		}
+
+		bool empty() const noexcept
+		{
+			return mHead.load(std::memory_order_acquire) == nullptr;
+		}
+
+		static T* next(T* node) noexcept
+		{
+			return static_cast<T*>(static_cast<MpscNode*>(node)->mpscNext);
+		}
+	};
+
+} }
@@ -0,0 +1,323 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <common/mpsc_queue.hpp>
+
+namespace gsio { namespace common {
+
+	// size-class slab allocator
+	// every thread allocates from its own cache without locking,
+	// a block freed by another thread goes back to the cache it was carved from through a lock-free queue,
+	// memory is kept by the pool once carved, so steady state has no malloc / free
+	class SlabPool
+	{
+	public:
+		// block sizes are 64, 128, ... 64K bytes, header included
+		static const size_t MinClassShift = 6;
+		static const size_t MaxClassShift = 16;
+		static const size_t ClassCount = MaxClassShift - MinClassShift + 1;
+		static const size_t ChunkSize = 256 * 1024;
+
+	private:
+		class ThreadCache;
+
+		struct alignas(16) BlockHeader : public MpscNode
+		{
+			ThreadCache* cache;
+			size_t sizeClass;
+		};
+
+		static const size_t LargeClass = ClassCount;
+
+		class ThreadCache
+		{
+		public:
+			BlockHeader* freeList[ClassCount]{};
+			// blocks released by other threads
+			MpscQueue<BlockHeader> returned;
+		};
+
+		// owned by a thread, handed back to the pool when the thread exits
+		// so a new thread can adopt it together with its outstanding blocks
+		struct ThreadCacheHolder
+		{
+			ThreadCache* cache{ nullptr };
+
+			~ThreadCacheHolder()
+			{
+				if (cache != nullptr)
+				{
+					Instance().abandon(cache);
+					cache = nullptr;
+				}
+			}
+		};
+
+		std::mutex mGuard;
+		std::vector<ThreadCache*> mAbandonedCaches;
+
+		SlabPool() = default;
+
+	public:
+		SlabPool(const SlabPool&) = delete;
+		SlabPool& operator=(const SlabPool&) = delete;
+
+		// never destroyed, io threads may still release blocks while the process exits
+		static SlabPool& Instance()
+		{
+			static auto pool = new SlabPool();
+			return *pool;
+		}
+
+		static size_t sizeClassOf(size_t size) noexcept
+		{
+			const auto blockSize = size + sizeof(BlockHeader);
+			size_t sizeClass = 0;
+			while (sizeClass < ClassCount && (size_t(1) << (sizeClass + MinClassShift)) < blockSize)
+			{
+				sizeClass++;
+			}
+			return sizeClass;
+		}
+
+		void* allocate(size_t size)
+		{
+			const auto sizeClass = sizeClassOf(size);
+			if (sizeClass == LargeClass)
+			{
+				auto header = static_cast<BlockHeader*>(std::malloc(size + sizeof(BlockHeader)));
+				if (header == nullptr)
+				{
+					throw std::bad_alloc();
+				}
+				header->cache = nullptr;
+				header->sizeClass = LargeClass;
+				return header + 1;
+			}
+
+			auto cache = localCache();
+			auto& freeList = cache->freeList[sizeClass];
+			if (freeList == nullptr)
+			{
+				reclaim(cache);
+			}
+			if (freeList == nullptr)
+			{
+				refill(cache, sizeClass);
+			}
+
+			auto header = freeList;
+			freeList = static_cast<BlockHeader*>(header->mpscNext);
+			return header + 1;
+		}
+
+		void deallocate(void* ptr) noexcept
+		{
+			if (ptr == nullptr)
+			{
+				return;
+			}
+
+			auto header = static_cast<BlockHeader*>(ptr) - 1;
+			if (header->sizeClass == LargeClass)
+			{
+				std::free(header);
+				return;
+			}
+
+			auto cache = header->cache;
+			if (cache == localCacheHolder().cache)
+			{
+				header->mpscNext = cache->freeList[header->sizeClass];
+				cache->freeList[header->sizeClass] = header;
+			}
+			else
+			{
+				cache->returned.push(header);
+			}
+		}
+
+	private:
+		static ThreadCacheHolder& localCacheHolder() noexcept
+		{
+			static thread_local ThreadCacheHolder holder;
+			return holder;
+		}
+
+		ThreadCache* localCache()
+		{
+			auto& holder = localCacheHolder();
+			if (holder.cache == nullptr)
+			{
+				std::lock_guard<std::mutex> lck(mGuard);
+				if (!mAbandonedCaches.empty())
+				{
+					holder.cache = mAbandonedCaches.back();
+					mAbandonedCaches.pop_back();
+				}
+				else
+				{
+					holder.cache = new ThreadCache();
+				}
+			}
+			return holder.cache;
+		}
+
+		void abandon(ThreadCache* cache)
+		{
+			std::lock_guard<std::mutex> lck(mGuard);
+			mAbandonedCaches.push_back(cache);
+		}
+
+		static void reclaim(ThreadCache* cache) noexcept
+		{
+			auto header = cache->returned.popAll();
+			while (header != nullptr)
+			{
+				auto nextHeader = MpscQueue<BlockHeader>::next(header);
+				header->mpscNext = cache->freeList[header->sizeClass];
+				cache->freeList[header->sizeClass] = header;
+				header = nextHeader;
+			}
+		}
+
+		static void refill(ThreadCache* cache, size_t sizeClass)
+		{
+			const auto blockSize = size_t(1) << (sizeClass + MinClassShift);
+			const auto chunkSize = std::max(static_cast<size_t>(ChunkSize), blockSize * 4);
+			auto chunk = static_cast<char*>(std::malloc(chunkSize));
+			if (chunk == nullptr)
+			{
+				throw std::bad_alloc();
+			}
+
+			for (size_t offset = 0; offset + blockSize <= chunkSize; offset += blockSize)
+			{
+				auto header = reinterpret_cast<BlockHeader*>(chunk + offset);
+				header->cache = cache;
+				header->sizeClass = sizeClass;
+				header->mpscNext = cache->freeList[sizeClass];
+				cache->freeList[sizeClass] = header;
+			}
+		}
+	};
+
+	// std allocator on top of SlabPool, e.g. for shared_ptr control blocks
+	template<typename T>
+	class SlabAllocator
+	{
+	public:
+		using value_type = T;
+
+		SlabAllocator() noexcept = default;
+
+		template<typename U>
+		SlabAllocator(const SlabAllocator<U>&) noexcept
+		{}
+
+		T* allocate(size_t n)
+		{
+			return static_cast<T*>(SlabPool::Instance().allocate(n * sizeof(T)));
+		}
+
+		void deallocate(T* ptr, size_t) noexcept
+		{
+			SlabPool::Instance().deallocate(ptr);
+		}
+
+		template<typename U>
+		bool operator==(const SlabAllocator<U>&) const noexcept
+		{
+			return true;
+		}
+
+		template<typename U>
+		bool operator!=(const SlabAllocator<U>&) const noexcept
+		{
+			return false;
+		}
+	};
+
+	// outbound byte buffer living in one slab block, the shared_ptr control block is pooled too
+	class SlabBuffer
+	{
+	private:
+		char* mData;
+		size_t mSize;
+		size_t mCapacity;
+
+		SlabBuffer(char* data, size_t capacity)
+			: mData(data), mSize(0), mCapacity(capacity)
+		{}
+
+		struct Deleter
+		{
+			void operator()(SlabBuffer* buffer) const noexcept
+			{
+				buffer->~SlabBuffer();
+				SlabPool::Instance().deallocate(buffer);
+			}
+		};
+
+	public:
+		using Ptr = std::shared_ptr<SlabBuffer>;
+
+		static Ptr Make(size_t capacity)
+		{
+			auto block = static_cast<char*>(SlabPool::Instance().allocate(sizeof(SlabBuffer) + capacity));
+			auto buffer = new (block) SlabBuffer(block + sizeof(SlabBuffer), capacity);
+			// shared_ptr calls the deleter itself if allocating the control block throws
+			return Ptr(buffer, Deleter(), SlabAllocator<SlabBuffer>());
+		}
+
+		static Ptr Make(const void* data, size_t size)
+		{
+			auto buffer = Make(size);
+			buffer->append(data, size);
+			return buffer;
+		}
+
+		char* data() noexcept
+		{
+			return mData;
+		}
+
+		const char* data() const noexcept
+		{
+			return mData;
+		}
+
+		size_t size() const noexcept
+		{
+			return mSize;
+		}
+
+		size_t capacity() const noexcept
+		{
+			return mCapacity;
+		}
+
+		// size must not exceed capacity
+		void resize(size_t size) noexcept
+		{
+			mSize = std::min(size, mCapacity);
+		}
+
+		size_t append(const void* data, size_t size) noexcept
+		{
+			const auto len = std::min(size, mCapacity - mSize);
+			std::memcpy(mData + mSize, data, len);
+			mSize += len;
+			return len;
+		}
+	};
+
+} }
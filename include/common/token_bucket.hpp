@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+namespace gsio { namespace common {
+
+	// token bucket rate limiter, one token is one byte
+	// not thread safe, owned by the io thread of a session
+	class TokenBucket
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+	private:
+		size_t mRate{ 0 };
+		size_t mBurst{ 0 };
+		double mTokens{ 0 };
+		Clock::time_point mLastRefill;
+
+	public:
+		// rate in bytes per second, 0 disables the limit
+		// burst is the bucket size, 0 picks 100ms worth of rate
+		void reset(size_t rate, size_t burst, Clock::time_point now) noexcept
+		{
+			mRate = rate;
+			mBurst = burst > 0 ? burst : std::max<size_t>(1, rate / 10);
+			mTokens = static_cast<double>(mBurst);
+			mLastRefill = now;
+		}
+
+		bool enabled() const noexcept
+		{
+			return mRate > 0;
+		}
+
+		size_t rate() const noexcept
+		{
+			return mRate;
+		}
+
+		size_t burst() const noexcept
+		{
+			return mBurst;
+		}
+
+		size_t available(Clock::time_point now) noexcept
+		{
+			refill(now);
+			return static_cast<size_t>(mTokens);
+		}
+
+		void consume(size_t bytes) noexcept
+		{
+			mTokens -= static_cast<double>(bytes);
+		}
+
+		// time until at least bytes tokens are available, bytes must not exceed burst
+		Clock::duration timeUntil(size_t bytes, Clock::time_point now) noexcept
+		{
+			refill(now);
+			if (mTokens >= static_cast<double>(bytes))
+			{
+				return Clock::duration::zero();
+			}
+
+			const auto seconds = (static_cast<double>(bytes) - mTokens) / static_cast<double>(mRate);
+			return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds)) + Clock::duration(1);
+		}
+
+	private:
+		void refill(Clock::time_point now) noexcept
+		{
+			if (now <= mLastRefill)
+			{
+				return;
+			}
+
+			const auto elapsed = std::chrono::duration<double>(now - mLastRefill).count();
+			mTokens = std::min(static_cast<double>(mBurst), mTokens + elapsed * static_cast<double>(mRate));
+			mLastRefill = now;
+		}
+	};
+
+} }
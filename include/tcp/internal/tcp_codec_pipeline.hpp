@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include <tcp/internal/tcp_frame_codec.hpp>
+#include <tcp/internal/tcp_send_pieces.hpp>
+#include <tcp/internal/tcp_session.hpp>
+
+namespace gsio {
+	namespace tcp {
+		namespace internal {
+
+			// stages composed at compile time, every stage is called as stage(args..., next) and hands its output
+			// to next(output...), the last stage is called without next, so the whole chain is inlined into one call
+			// decode: stage(session, data, size, next), the first stage returns the consumed bytes,
+			//         the pipeline converts to TcpSession::DataHandler, every session gets its own copy of the stages
+			// encode: stage(session, pieces, owner, next), see LengthPrefixEncoder and SessionSender
+			template<typename... Stages>
+			class CodecPipeline;
+
+			template<typename Last>
+			class CodecPipeline<Last>
+			{
+			private:
+				Last mLast;
+
+			public:
+				explicit CodecPipeline(Last last)
+					: mLast(std::move(last))
+				{}
+
+				template<typename... Args>
+				decltype(auto) operator()(Args&&... args)
+				{
+					return mLast(std::forward<Args>(args)...);
+				}
+			};
+
+			template<typename First, typename... Rest>
+			class CodecPipeline<First, Rest...>
+			{
+			private:
+				First mFirst;
+				CodecPipeline<Rest...> mRest;
+
+			public:
+				CodecPipeline(First first, Rest... rest)
+					: mFirst(std::move(first)), mRest(std::move(rest)...)
+				{}
+
+				template<typename... Args>
+				decltype(auto) operator()(Args&&... args)
+				{
+					return mFirst(std::forward<Args>(args)..., mRest);
+				}
+			};
+
+			template<typename... Stages>
+			CodecPipeline<std::decay_t<Stages>...> MakeCodecPipeline(Stages&&... stages)
+			{
+				return CodecPipeline<std::decay_t<Stages>...>(std::forward<Stages>(stages)...);
+			}
+
+			// first decode stage, hands every complete frame to next without copying it
+			// an oversized frame closes the session, TcpSessionOption::frameCodec also rejects it before the buffer grows
+			class LengthPrefixDecoder
+			{
+			private:
+				FrameCodecOption mOption;
+
+			public:
+				explicit LengthPrefixDecoder(FrameCodecOption option)
+					: mOption(option)
+				{
+					mOption.headerSize = std::max<size_t>(1, std::min(mOption.headerSize, static_cast<size_t>(FrameCodec::MaxHeaderSize)));
+				}
+
+				template<typename Next>
+				size_t operator()(const TcpSession::Ptr& session, const char* data, size_t size, Next& next)
+				{
+					auto oversized = false;
+					const auto procLen = FrameCodec::decode(mOption, data, size, [&session, &next](const char* frame, size_t frameSize)
+					{
+						next(session, frame, frameSize);
+					}, oversized);
+					if (oversized)
+					{
+						// the same close path as TcpSessionOption::frameCodec, the closed handler is called
+						session->dispatchClose();
+					}
+					else
+					{
+						session->needRecvBytes(FrameCodec::missing(mOption, data + procLen, size - procLen));
+					}
+					return procLen;
+				}
+			};
+
+			// encode stage, puts the length header in front of the pieces
+			class LengthPrefixEncoder
+			{
+			private:
+				struct FramedOwner
+				{
+					std::array<char, FrameCodec::MaxHeaderSize> header;
+					TcpSession::SendOwner owner;
+				};
+
+				FrameCodecOption mOption;
+
+			public:
+				explicit LengthPrefixEncoder(FrameCodecOption option)
+					: mOption(option)
+				{
+					mOption.headerSize = std::max<size_t>(1, std::min(mOption.headerSize, static_cast<size_t>(FrameCodec::MaxHeaderSize)));
+				}
+
+				template<typename Next>
+				void operator()(const TcpSession::Ptr& session, const SendPieces& pieces, TcpSession::SendOwner owner, Next& next)
+				{
+					// the header lives as long as the message, together with the owner of the payload
+					auto framed = std::make_shared<FramedOwner>();
+					framed->header = FrameCodec::header(mOption, pieces.bytes());
+					framed->owner = std::move(owner);
+
+					SendPieces framedPieces;
+					framedPieces.push(asio::buffer(framed->header.data(), mOption.headerSize));
+					pieces.visit(0, [&framedPieces](asio::const_buffer piece)
+					{
+						framedPieces.push(piece);
+						return true;
+					});
+					next(session, framedPieces, std::move(framed));
+				}
+			};
+
+			// last encode stage, queues the message on the session
+			class SessionSender
+			{
+			private:
+				SendOptions mOptions;
+
+			public:
+				explicit SessionSender(SendOptions options = SendOptions())
+					: mOptions(options)
+				{}
+
+				void operator()(const TcpSession::Ptr& session, const SendPieces& pieces, TcpSession::SendOwner owner)
+				{
+					session->send(pieces, std::move(owner), mOptions);
+				}
+			};
+
+		}
+	}
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace gsio {
+	namespace tcp {
+		namespace internal {
+
+			enum class FrameByteOrder
+			{
+				BigEndian,
+				LittleEndian,
+			};
+
+			// length prefixed frames, the header holds the payload length only
+			struct FrameCodecOption
+			{
+				// width of the length header in bytes, at most 8, 0 disables framing
+				size_t headerSize = 0;
+				FrameByteOrder byteOrder = FrameByteOrder::BigEndian;
+				// payload bytes, a larger frame closes the connection as soon as its header arrives
+				size_t maxFrameSize = 64 * 1024;
+			};
+
+			class FrameCodec
+			{
+			public:
+				static const size_t MaxHeaderSize = 8;
+
+				static uint64_t readLength(const FrameCodecOption& option, const char* header) noexcept
+				{
+					const auto bytes = reinterpret_cast<const unsigned char*>(header);
+					uint64_t length = 0;
+					for (size_t i = 0; i < option.headerSize; i++)
+					{
+						const auto index = option.byteOrder == FrameByteOrder::BigEndian ? i : option.headerSize - 1 - i;
+						length = (length << 8) | bytes[index];
+					}
+					return length;
+				}
+
+				// header for a payload of payloadSize bytes, the first option.headerSize bytes are used
+				static std::array<char, MaxHeaderSize> header(const FrameCodecOption& option, uint64_t payloadSize) noexcept
+				{
+					std::array<char, MaxHeaderSize> header{};
+					for (size_t i = 0; i < option.headerSize; i++)
+					{
+						const auto index = option.byteOrder == FrameByteOrder::BigEndian ? option.headerSize - 1 - i : i;
+						header[index] = static_cast<char>(payloadSize & 0xff);
+						payloadSize >>= 8;
+					}
+					return header;
+				}
+
+				// bytes still missing for the partial frame at the front of data, size is less than one frame
+				static size_t missing(const FrameCodecOption& option, const char* data, size_t size) noexcept
+				{
+					if (size < option.headerSize)
+					{
+						return option.headerSize - size;
+					}
+					const auto frameSize = option.headerSize + readLength(option, data);
+					return frameSize > size ? static_cast<size_t>(frameSize - size) : 0;
+				}
+
+				// calls handler(payload, size) for every complete frame at the front of data, payload points into data
+				// returns the bytes of the complete frames, the rest is a partial frame
+				// oversized is set when the next frame is larger than maxFrameSize, nothing after it is decoded
+				template<typename Handler>
+				static size_t decode(const FrameCodecOption& option, const char* data, size_t size, Handler&& handler, bool& oversized)
+				{
+					size_t consumed = 0;
+					while (size - consumed >= option.headerSize)
+					{
+						const auto length = readLength(option, data + consumed);
+						if (length > option.maxFrameSize)
+						{
+							oversized = true;
+							break;
+						}
+						if (size - consumed - option.headerSize < length)
+						{
+							break;
+						}
+
+						handler(data + consumed + option.headerSize, static_cast<size_t>(length));
+						consumed += option.headerSize + static_cast<size_t>(length);
+					}
+					return consumed;
+				}
+			};
+
+		}
+	}
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+
+#include <asio.hpp>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(MFD_CLOEXEC) && defined(MADV_REMOVE)
+#define GSIO_HAS_MIRRORED_RECV_BUFFER 1
+#else
+#define GSIO_HAS_MIRRORED_RECV_BUFFER 0
+#endif
+
+namespace gsio {
+	namespace tcp {
+		namespace internal {
+
+			// receive buffer of a session, readable bytes are always one contiguous block
+			// all methods are called in the io thread of the session
+			class RecvBuffer
+			{
+			public:
+				virtual ~RecvBuffer() = default;
+
+				// writable space right after the readable bytes, size() + n must not exceed the max size
+				virtual asio::mutable_buffer prepare(size_t n) = 0;
+				virtual void commit(size_t n) = 0;
+				virtual asio::const_buffer data() const = 0;
+				virtual void consume(size_t n) = 0;
+				virtual size_t size() const = 0;
+				// the target size went down to targetSize, may give memory back
+				virtual void reclaim(size_t targetSize) = 0;
+			};
+
+			using RecvBufferFactory = std::function<std::unique_ptr<RecvBuffer>(size_t maxSize)>;
+
+			// asio::streambuf, consume and prepare move the unconsumed bytes back to the front now and then
+			class StreambufRecvBuffer : public RecvBuffer
+			{
+			private:
+				const size_t mMaxSize;
+				std::unique_ptr<asio::streambuf> mBuffer;
+
+			public:
+				explicit StreambufRecvBuffer(size_t maxSize)
+					: mMaxSize(maxSize), mBuffer(std::make_unique<asio::streambuf>(maxSize))
+				{}
+
+				asio::mutable_buffer prepare(size_t n) override
+				{
+					return mBuffer->prepare(n);
+				}
+
+				void commit(size_t n) override
+				{
+					mBuffer->commit(n);
+				}
+
+				asio::const_buffer data() const override
+				{
+					return mBuffer->data();
+				}
+
+				void consume(size_t n) override
+				{
+					mBuffer->consume(n);
+				}
+
+				size_t size() const override
+				{
+					return mBuffer->size();
+				}
+
+				// the streambuf never gives memory back, a drained one much larger than the target is replaced
+				void reclaim(size_t targetSize) override
+				{
+					if (mBuffer->size() != 0 || mBuffer->capacity() <= 2 * targetSize)
+					{
+						return;
+					}
+
+					mBuffer = std::make_unique<asio::streambuf>(mMaxSize);
+				}
+			};
+
+			// ring over a memfd which is mapped twice back to back (linux only),
+			// readable bytes that wrap around the end continue in the second mapping,
+			// so they are contiguous without ever moving them
+			// pages are only backed once written, reclaim hands them back to the kernel
+			class MirroredRecvBuffer : public RecvBuffer
+			{
+			private:
+				char* mBase;
+				const size_t mCapacity;
+				size_t mHead{ 0 };
+				size_t mSize{ 0 };
+				// end of the region written since the last reclaim
+				size_t mTouched{ 0 };
+
+				MirroredRecvBuffer(char* base, size_t capacity)
+					: mBase(base), mCapacity(capacity)
+				{}
+
+			public:
+				MirroredRecvBuffer(const MirroredRecvBuffer&) = delete;
+				MirroredRecvBuffer& operator=(const MirroredRecvBuffer&) = delete;
+
+				~MirroredRecvBuffer() override
+				{
+#if GSIO_HAS_MIRRORED_RECV_BUFFER
+					::munmap(mBase, 2 * mCapacity);
+#endif
+				}
+
+				// capacity is maxSize rounded up to whole pages, nullptr if the mapping can't be set up
+				static std::unique_ptr<MirroredRecvBuffer> Make(size_t maxSize)
+				{
+#if GSIO_HAS_MIRRORED_RECV_BUFFER
+					const auto pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+					const auto capacity = (std::max<size_t>(1, maxSize) + pageSize - 1) / pageSize * pageSize;
+
+					const auto fd = ::memfd_create("gsio_recv_buffer", MFD_CLOEXEC);
+					if (fd < 0)
+					{
+						return nullptr;
+					}
+					if (::ftruncate(fd, capacity) != 0)
+					{
+						::close(fd);
+						return nullptr;
+					}
+
+					// reserve both halves first, so nothing else can be mapped in between
+					auto base = static_cast<char*>(::mmap(nullptr, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+					if (base == MAP_FAILED)
+					{
+						::close(fd);
+						return nullptr;
+					}
+
+					const auto mapped =
+						::mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+						::mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+					// the mappings keep the memory alive
+					::close(fd);
+					if (!mapped)
+					{
+						::munmap(base, 2 * capacity);
+						return nullptr;
+					}
+
+					return std::unique_ptr<MirroredRecvBuffer>(new MirroredRecvBuffer(base, capacity));
+#else
+					(void)maxSize;
+					return nullptr;
+#endif
+				}
+
+				// falls back to StreambufRecvBuffer where the mapping isn't available
+				static RecvBufferFactory Factory()
+				{
+					return [](size_t maxSize)
+					{
+						std::unique_ptr<RecvBuffer> buffer = Make(maxSize);
+						if (buffer == nullptr)
+						{
+							buffer = std::make_unique<StreambufRecvBuffer>(maxSize);
+						}
+						return buffer;
+					};
+				}
+
+				asio::mutable_buffer prepare(size_t n) override
+				{
+					if (mSize + n > mCapacity)
+					{
+						throw std::length_error("mirrored receive buffer too long");
+					}
+					return asio::mutable_buffer(mBase + (mHead + mSize) % mCapacity, n);
+				}
+
+				void commit(size_t n) override
+				{
+					mSize += std::min(n, mCapacity - mSize);
+					mTouched = std::min(mCapacity, std::max(mTouched, mHead + mSize));
+				}
+
+				asio::const_buffer data() const override
+				{
+					return asio::const_buffer(mBase + mHead, mSize);
+				}
+
+				void consume(size_t n) override
+				{
+					n = std::min(n, mSize);
+					mSize -= n;
+					// start over at the front once drained, keeps the touched pages few
+					mHead = mSize == 0 ? 0 : (mHead + n) % mCapacity;
+				}
+
+				size_t size() const override
+				{
+					return mSize;
+				}
+
+				void reclaim(size_t targetSize) override
+				{
+#if GSIO_HAS_MIRRORED_RECV_BUFFER
+					if (mSize != 0 || mTouched <= 2 * targetSize)
+					{
+						return;
+					}
+
+					// frees the memfd pages, they read as zero when touched again
+					::madvise(mBase, mCapacity, MADV_REMOVE);
+					mTouched = 0;
+#else
+					(void)targetSize;
+#endif
+				}
+			};
+
+		}
+	}
+}
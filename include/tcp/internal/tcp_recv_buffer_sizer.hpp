@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+namespace gsio {
+	namespace tcp {
+		namespace internal {
+
+			// decides how large the receive buffer of a session should be for its next read
+			class RecvBufferSizer
+			{
+			public:
+				virtual ~RecvBufferSizer() = default;
+
+				// size: current target size of the receive buffer
+				// filled: the read used all the space prepared for it, more data is probably waiting
+				// returns the target size for the next read, clamped to [minSize, maxSize] by the session
+				virtual size_t next(size_t size, size_t received, bool filled) = 0;
+			};
+
+			using RecvBufferSizerFactory = std::function<std::unique_ptr<RecvBufferSizer>(size_t minSize, size_t maxSize)>;
+
+			// grows along a tanh curve on every filled read and never shrinks
+			class TanhRecvBufferSizer : public RecvBufferSizer
+			{
+			private:
+				const size_t mMinSize;
+				const size_t mMaxSize;
+				double mCurrentTanhXDiff{ 0 };
+
+			public:
+				TanhRecvBufferSizer(size_t minSize, size_t maxSize)
+					: mMinSize(minSize), mMaxSize(maxSize)
+				{}
+
+				size_t next(size_t size, size_t, bool filled) override
+				{
+					if (!filled)
+					{
+						return size;
+					}
+
+					const auto TanhXDiff = 0.2;
+
+					const auto oldTanh = std::tanh(mCurrentTanhXDiff);
+					mCurrentTanhXDiff += TanhXDiff;
+					const auto newTanh = std::tanh(mCurrentTanhXDiff);
+					const auto maxSizeDiff = mMaxSize - std::min<size_t>(mMaxSize, mMinSize);
+					const auto sizeDiff = maxSizeDiff * (newTanh - oldTanh);
+
+					return std::min<size_t>(size + static_cast<size_t>(sizeDiff), mMaxSize);
+				}
+			};
+
+			// doubles on every filled read, halves after shrinkAfterReads reads in a row used less than a quarter,
+			// so a burst doesn't pin a large buffer for the rest of the connection
+			class AdaptiveRecvBufferSizer : public RecvBufferSizer
+			{
+			private:
+				const size_t mMinSize;
+				const size_t mMaxSize;
+				const size_t mShrinkAfterReads;
+				size_t mSmallReads{ 0 };
+
+			public:
+				AdaptiveRecvBufferSizer(size_t minSize, size_t maxSize, size_t shrinkAfterReads = 4)
+					: mMinSize(minSize), mMaxSize(maxSize), mShrinkAfterReads(std::max<size_t>(1, shrinkAfterReads))
+				{}
+
+				static RecvBufferSizerFactory Factory(size_t shrinkAfterReads = 4)
+				{
+					return [shrinkAfterReads](size_t minSize, size_t maxSize)
+					{
+						return std::unique_ptr<RecvBufferSizer>(new AdaptiveRecvBufferSizer(minSize, maxSize, shrinkAfterReads));
+					};
+				}
+
+				size_t next(size_t size, size_t received, bool filled) override
+				{
+					if (filled)
+					{
+						mSmallReads = 0;
+						return std::min(size * 2, mMaxSize);
+					}
+
+					if (received >= size / 4)
+					{
+						mSmallReads = 0;
+						return size;
+					}
+
+					if (++mSmallReads < mShrinkAfterReads)
+					{
+						return size;
+					}
+
+					mSmallReads = 0;
+					return std::max(size / 2, mMinSize);
+				}
+			};
+
+		}
+	}
+}
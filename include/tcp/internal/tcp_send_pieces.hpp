@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vector>
+
+#include <asio/buffer.hpp>
+
+namespace gsio {
+	namespace tcp {
+		namespace internal {
+
+			// buffer pieces of one outbound message, sent by writev without being merged
+			// the first few pieces are stored inline, typically header + body
+			class SendPieces
+			{
+			private:
+				static const size_t InlineCapacity = 4;
+
+				asio::const_buffer mInline[InlineCapacity];
+				std::vector<asio::const_buffer> mOverflow;
+				size_t mCount{ 0 };
+				size_t mBytes{ 0 };
+
+			public:
+				SendPieces() = default;
+
+				template<typename ConstBufferSequence>
+				explicit SendPieces(const ConstBufferSequence& buffers)
+				{
+					const auto end = asio::buffer_sequence_end(buffers);
+					for (auto it = asio::buffer_sequence_begin(buffers); it != end; ++it)
+					{
+						push(asio::const_buffer(*it));
+					}
+				}
+
+				void push(asio::const_buffer buffer)
+				{
+					if (buffer.size() == 0)
+					{
+						return;
+					}
+
+					if (mCount < InlineCapacity)
+					{
+						mInline[mCount] = buffer;
+					}
+					else
+					{
+						mOverflow.push_back(buffer);
+					}
+					mCount++;
+					mBytes += buffer.size();
+				}
+
+				void clear() noexcept
+				{
+					mOverflow.clear();
+					mCount = 0;
+					mBytes = 0;
+				}
+
+				size_t count() const noexcept
+				{
+					return mCount;
+				}
+
+				size_t bytes() const noexcept
+				{
+					return mBytes;
+				}
+
+				const asio::const_buffer& operator[](size_t index) const noexcept
+				{
+					return index < InlineCapacity ? mInline[index] : mOverflow[index - InlineCapacity];
+				}
+
+				// calls visitor with every piece which is not yet sent, skipping the first offset bytes
+				// visitor returns false to stop, the result tells whether all pieces were visited
+				template<typename Visitor>
+				bool visit(size_t offset, Visitor&& visitor) const
+				{
+					for (size_t i = 0; i < mCount; i++)
+					{
+						const auto& piece = (*this)[i];
+						if (offset >= piece.size())
+						{
+							offset -= piece.size();
+							continue;
+						}
+
+						if (!visitor(piece + offset))
+						{
+							return false;
+						}
+						offset = 0;
+					}
+
+					return true;
+				}
+			};
+
+		}
+	}
+}
@@ -1,22 +1,100 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <memory>
 #include <functional>
-#include <mutex>
-#include <deque>
-#include <cmath>
+#include <initializer_list>
+#include <limits>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 #include <iostream>
 
 #include <asio.hpp>
 #include <asio/socket_base.hpp>
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <signal.h>
+#include <sys/sendfile.h>
+#elif !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#include <common/mpsc_queue.hpp>
+#include <common/slab_pool.hpp>
+#include <common/token_bucket.hpp>
+#include <tcp/internal/tcp_recv_buffer.hpp>
+#include <tcp/internal/tcp_recv_buffer_sizer.hpp>
+#include <tcp/internal/tcp_send_pieces.hpp>
+#include <tcp/internal/tcp_session_option.hpp>
+#include <tcp/internal/tcp_write_scheduler.hpp>
+#include <tcp/internal/tcp_zero_copy.hpp>
+
 
 namespace gsio {
 	namespace tcp {
 		namespace internal {
 
 			const size_t MinReceivePrepareSize = 1024;
+			// upper bound of one sendfile call, so a huge file doesn't hold the io thread
+			const size_t MaxSendFileChunkSize = 1024 * 1024;
+			// a rate limited session waits for this many tokens (or the whole burst) instead of writing a few bytes
+			const size_t MinRateLimitedWrite = 4 * 1024;
+
+#if defined(__linux__)
+			// sendfile(2) has no MSG_NOSIGNAL, SIGPIPE is blocked in the calling thread while the guard lives,
+			// a SIGPIPE raised meanwhile is consumed before the mask is restored, the caller sees EPIPE
+			class SigPipeGuard : public asio::noncopyable
+			{
+			public:
+				SigPipeGuard() noexcept
+				{
+					sigemptyset(&mSigPipe);
+					sigaddset(&mSigPipe, SIGPIPE);
+
+					sigset_t pending;
+					sigemptyset(&pending);
+					sigpending(&pending);
+					// one raised before is left to the process
+					mPendingBefore = sigismember(&pending, SIGPIPE) == 1;
+					mBlocked = pthread_sigmask(SIG_BLOCK, &mSigPipe, &mOldMask) == 0;
+				}
+
+				~SigPipeGuard()
+				{
+					if (!mBlocked)
+					{
+						return;
+					}
+
+					if (!mPendingBefore)
+					{
+						sigset_t pending;
+						sigemptyset(&pending);
+						sigpending(&pending);
+						if (sigismember(&pending, SIGPIPE) == 1)
+						{
+							const struct timespec noWait = { 0, 0 };
+							while (sigtimedwait(&mSigPipe, nullptr, &noWait) == -1 && errno == EINTR)
+							{
+							}
+						}
+					}
+					pthread_sigmask(SIG_SETMASK, &mOldMask, nullptr);
+				}
+
+			private:
+				sigset_t mSigPipe;
+				sigset_t mOldMask;
+				bool mPendingBefore{ false };
+				bool mBlocked{ false };
+			};
+#endif
+
+			class TcpSessionGroup;
 
 			class TcpSession : public asio::noncopyable,
 				public std::enable_shared_from_this<TcpSession>
@@ -26,37 +104,265 @@ namespace gsio {
 				using DataHandler = std::function<size_t(Ptr, const char*, size_t)>;
 				using ClosedHandler = std::function<void(Ptr)>;
 				using SendCompletedCallback = std::function<void()>;
+				// cumulative count of messages and bytes handed to the kernel, in send order,
+				// called once per completed writev instead of once per message
+				using SendAckHandler = std::function<void(Ptr, uint64_t, uint64_t)>;
+				// keeps the memory of buffer pieces alive until they are sent,
+				// any ref-counted object, or a raw pointer with custom deleter / pool release
+				using SendOwner = std::shared_ptr<void>;
+
+				// next part of a stream, pieces must stay valid as long as owner
+				struct StreamChunk
+				{
+					SendPieces pieces;
+					SendOwner owner;
+				};
+				// fills the chunk and returns true, or returns false at the end of the stream
+				using StreamProducer = std::function<bool(StreamChunk&)>;
 
 			private:
 				asio::ip::tcp::socket mSocket;
+				asio::io_context& mIoContext;
+				// every handler of the session runs in it, so several threads may run mIoContext,
+				// "io thread only" below means inside this strand
+				asio::strand<asio::io_context::executor_type> mStrand;
 
-				// only make send / writev request once at the same time
-				bool mSending;
-				std::mutex mSendGuard;
+				struct StreamSource
+				{
+					StreamProducer producer;
+					// bytes of pulled chunks which are not sent yet
+					size_t outstanding{ 0 };
+				};
 
-				struct PendingMsg
+				struct PendingMsg : public common::MpscNode
 				{
-					size_t sendPos;
-					std::shared_ptr<std::string> msg;
+					size_t sendPos{ 0 };
+					SendPieces pieces;
+					SendOwner owner;
 					SendCompletedCallback callback;
+					SendLane lane{ SendLane::Bulk };
+					uint64_t conflationKey{ 0 };
+					std::chrono::steady_clock::time_point deadline;
+
+					// file region sent by sendfile(2) instead of pieces
+					int fileFd{ -1 };
+					uint64_t fileOffset{ 0 };
+					size_t fileLength{ 0 };
+
+					// sent by sendmsg(MSG_ZEROCOPY), zeroCopyId is the id of the last call
+					bool zeroCopy{ false };
+					bool zeroCopySent{ false };
+					uint32_t zeroCopyId{ 0 };
+
+					// placeholder of a stream which pulls chunks in front of itself, see sendStream,
+					// or a chunk pulled from stream when streamChunk is set
+					std::shared_ptr<StreamSource> stream;
+					bool streamChunk{ false };
+
+					bool isStream() const noexcept
+					{
+						return stream != nullptr && !streamChunk;
+					}
+
+					bool isFile() const noexcept
+					{
+						return fileFd >= 0;
+					}
+
+					// written alone by tryDirectSend instead of async_send
+					bool isDirect() const noexcept
+					{
+						return isFile() || zeroCopy;
+					}
+
+					size_t bytes() const noexcept
+					{
+						return isFile() ? fileLength : pieces.bytes();
+					}
+
+					bool isExpired() const noexcept
+					{
+						return deadline != std::chrono::steady_clock::time_point() &&
+							deadline <= std::chrono::steady_clock::now();
+					}
+
+					void apply(const SendOptions& options) noexcept
+					{
+						lane = options.lane;
+						conflationKey = options.conflationKey;
+						deadline = options.deadline;
+					}
+
+					// pending messages are recycled by the slab pool, so queuing doesn't hit malloc
+					static void* operator new(size_t size)
+					{
+						return common::SlabPool::Instance().allocate(size);
+					}
+
+					static void operator delete(void* ptr) noexcept
+					{
+						common::SlabPool::Instance().deallocate(ptr);
+					}
+				};
+				using SendQueue = common::MpscQueue<PendingMsg>;
+
+				// intrusive fifo of pending messages, linked by mpscNext
+				struct PendingList
+				{
+					PendingMsg* head{ nullptr };
+					PendingMsg* tail{ nullptr };
+
+					bool empty() const noexcept
+					{
+						return head == nullptr;
+					}
+
+					void pushBack(PendingMsg* msg) noexcept
+					{
+						msg->mpscNext = nullptr;
+						if (tail == nullptr)
+						{
+							head = msg;
+						}
+						else
+						{
+							tail->mpscNext = msg;
+						}
+						tail = msg;
+					}
+
+					PendingMsg* popFront() noexcept
+					{
+						const auto msg = head;
+						head = SendQueue::next(msg);
+						if (head == nullptr)
+						{
+							tail = nullptr;
+						}
+						msg->mpscNext = nullptr;
+						return msg;
+					}
+
+					// moves all messages of other in front of this list
+					void prepend(PendingList& other) noexcept
+					{
+						if (other.empty())
+						{
+							return;
+						}
+						other.tail->mpscNext = head;
+						if (tail == nullptr)
+						{
+							tail = other.tail;
+						}
+						head = other.head;
+						other.head = nullptr;
+						other.tail = nullptr;
+					}
+
+					PendingMsg* release() noexcept
+					{
+						const auto msg = head;
+						head = nullptr;
+						tail = nullptr;
+						return msg;
+					}
 				};
 
-				std::deque<PendingMsg> mPendingSendMsg;
+				// producers of any thread push here without locking,
+				// the io thread moves everything into mPendingSendMsg in one pass
+				SendQueue mSendQueue;
+
+				// only accessed in io thread
+				// only make send / writev request once at the same time
+				bool mSending;
+				// messages which haven't started sending, one list per SendLane
+				PendingList mPendingSendMsg[SendLaneCount];
+				// messages covered by the write in flight, or a partially sent message which must go first
+				PendingList mSendingMsg;
+				// queued messages with a conflation key, one map per lane
+				using ConflationMap = std::unordered_map<uint64_t, PendingMsg*, std::hash<uint64_t>, std::equal_to<uint64_t>,
+					common::SlabAllocator<std::pair<const uint64_t, PendingMsg*>>>;
+				ConflationMap mConflation[SendLaneCount];
+				uint64_t mConflatedMessages{ 0 };
+				uint64_t mExpiredMessages{ 0 };
 				std::vector<asio::const_buffer> mBuffers;
+				// tiny pieces are copied here so one iovec carries many of them
+				std::vector<char> mSendStaging;
+				bool mSendFlushScheduled{ false };
+				// a stream producer runs in the middle of building a write, sends from it are flushed afterwards
+				bool mPullingStream{ false };
+				std::unique_ptr<asio::steady_timer> mSendFlushTimer;
+				// deficit round robin state, see TcpWriteScheduler
+				bool mWriteScheduled{ false };
+				size_t mWriteDeficit{ 0 };
+				// egress rate limit, the kernel paces instead when mSendPacing is set
+				common::TokenBucket mSendRate;
+				bool mSendPacing{ false };
+				size_t mSendRateBudget{ 0 };
+				std::unique_ptr<asio::steady_timer> mSendRateTimer;
+				bool mSendRateTimerArmed{ false };
+				bool mSendRateResumed{ false };
+				common::TokenBucket::Clock::time_point mThrottledSince;
+				std::atomic<uint64_t> mThrottledNanoseconds{ 0 };
+				std::atomic<uint64_t> mThrottledBytes{ 0 };
+
+				const TcpSessionOption mOption;
+
+				// queued but not yet sent, messages still in mSendQueue included
+				std::atomic_size_t mQueuedBytes{ 0 };
+				std::atomic_size_t mQueuedMessages{ 0 };
+				bool mAboveHighWatermark{ false };
+				std::unique_ptr<asio::steady_timer> mSlowConsumerTimer;
+				bool mSlowConsumerTimerArmed{ false };
+				// SlowConsumerPolicy::Shutdown, new messages are discarded, the session closes once the started one is sent
+				bool mSendShutdown{ false };
+
+				SendAckHandler mSendAckHandler;
+				uint64_t mSentMessages{ 0 };
+				uint64_t mSentBytes{ 0 };
+
+				bool mZeroCopyEnabled{ false };
+				bool mZeroCopyWaiting{ false };
+				ZeroCopyTracker mZeroCopy;
 
 				bool mRecvPosted{ false };
+				// more bytes the data handler needs, see needRecvBytes
+				size_t mRecvNeed{ 0 };
+				int mRecvLowWatermark{ 1 };
+				bool mRecvPausedByUser{ false };
+				bool mRecvPausedByWork{ false };
+				std::atomic_size_t mRecvWork{ 0 };
 				DataHandler mDataHandler;
-				asio::streambuf mReceiveBuffer;
+				// frames go to mOption.frameHandler instead of mDataHandler
+				const bool mFraming;
+				const size_t mMaxRecvBufferSize;
+				// null while recvOnReadable waits with nothing kept
+				std::unique_ptr<RecvBuffer> mReceiveBuffer;
+				const size_t mMinPrepareSize;
+				// target size of the receive buffer, readable bytes included
 				size_t mCurrentPrepareSize;
+				// writable bytes handed to the posted receive
+				size_t mRecvPreparedSize{ 0 };
+				// the last read came back short and nothing is kept, so the peer has nothing more queued,
+				// the session waits for readability without a prepared buffer until more arrives
+				bool mRecvCaughtUp{ false };
+				std::chrono::steady_clock::time_point mRecvCaughtUpAt;
+				// gives the buffer of a past burst back once caught up for recvIdleReclaim
+				std::unique_ptr<asio::steady_timer> mRecvIdleTimer;
+				bool mRecvIdleTimerArmed{ false };
+				std::unique_ptr<RecvBufferSizer> mRecvBufferSizer;
 				ClosedHandler mClosedHandler;
-				double mCurrentTanhXDiff;
+				// set once the socket is closed, readable from any thread, e.g. to prune a TcpSessionGroup
+				std::atomic_bool mClosed{ false };
 
 			public:
 				static Ptr Make(
 					asio::ip::tcp::socket socket,
 					size_t maxRecvBufferSize,
 					DataHandler dataHandler,
-					ClosedHandler closedHandler)
+					ClosedHandler closedHandler,
+					const TcpSessionOption& option = TcpSessionOption())
 				{
 					class make_shared_enabler : public TcpSession
 					{
@@ -65,12 +371,14 @@ namespace gsio {
 							asio::ip::tcp::socket socket,
 							size_t maxRecvBufferSize,
 							DataHandler dataHandler,
-							ClosedHandler closedHandler)
+							ClosedHandler closedHandler,
+							const TcpSessionOption& option)
 							: TcpSession(
 								std::move(socket),
 								maxRecvBufferSize,
 								std::move(dataHandler),
-								std::move(closedHandler))
+								std::move(closedHandler),
+								option)
 						{}
 					};
 
@@ -78,32 +386,84 @@ namespace gsio {
 						std::move(socket),
 						maxRecvBufferSize,
 						std::move(dataHandler),
-						std::move(closedHandler));
+						std::move(closedHandler),
+						option);
 
-					session->tryAsyncRecv();
+					asio::post(session->mStrand, [session]()
+					{
+						session->tryAsyncRecv();
+					});
 
 					return std::static_pointer_cast<TcpSession>(session);
 				}
 
-				virtual ~TcpSession() = default;
+				virtual ~TcpSession()
+				{
+					releasePendingMsg(mSendingMsg.release());
+					for (auto& lane : mPendingSendMsg)
+					{
+						releasePendingMsg(lane.release());
+					}
+					releasePendingMsg(mSendQueue.popAll());
+				}
+
+				// bytes / messages queued but not yet sent
+				size_t queuedSendBytes() const noexcept
+				{
+					return mQueuedBytes.load(std::memory_order_relaxed);
+				}
+
+				size_t queuedSendMessages() const noexcept
+				{
+					return mQueuedMessages.load(std::memory_order_relaxed);
+				}
+
+				// messages replaced by a newer one with the same conflation key, io thread only
+				uint64_t conflatedSendMessages() const noexcept
+				{
+					return mConflatedMessages;
+				}
+
+				// messages dropped because their deadline passed before they started sending, io thread only
+				uint64_t expiredSendMessages() const noexcept
+				{
+					return mExpiredMessages;
+				}
+
+				SendRateStats sendRateStats() const noexcept
+				{
+					return { mThrottledNanoseconds.load(std::memory_order_relaxed), mThrottledBytes.load(std::memory_order_relaxed) };
+				}
+
+				ZeroCopyStats zeroCopyStats() const noexcept
+				{
+					return mZeroCopy.stats();
+				}
+
+				// io_context which runs all handlers of this session, serialized by its strand
+				asio::io_context& context() const
+				{
+					return mIoContext;
+				}
 
+				// callback runs in the strand of the session, serialized with its handlers
 				auto runAfter(std::chrono::nanoseconds timeout, std::function<void(void)> callback)
 				{
-					auto timer = std::make_shared<asio::steady_timer>(mSocket.get_executor());
+					auto timer = std::make_shared<asio::steady_timer>(mIoContext);
 					timer->expires_from_now(timeout);
-					timer->async_wait([callback = std::move(callback), timer](const asio::error_code& ec)
+					timer->async_wait(asio::bind_executor(mStrand, [callback = std::move(callback), timer](const asio::error_code& ec)
 					{
 						if (!ec)
 						{
 							callback();
 						}
-					});
+					}));
 					return timer;
 				}
 
 				void asyncSetDataHandler(DataHandler dataHandler)
 				{
-					asio::post(mSocket.get_executor(),
+					asio::post(mStrand,
 						[self = shared_from_this(), this, dataHandler = std::move(dataHandler)]()mutable
 					{
 						mDataHandler = std::move(dataHandler);
@@ -112,232 +472,1703 @@ namespace gsio {
 					});
 				}
 
-				void postClose() noexcept
+				// cheap delivery tracking for high-rate streams, see SendAckHandler
+				void asyncSetSendAckHandler(SendAckHandler sendAckHandler)
 				{
-					asio::post(mSocket.get_executor(),
-						[self = shared_from_this(), this]()
+					asio::post(mStrand,
+						[self = shared_from_this(), this, sendAckHandler = std::move(sendAckHandler)]()mutable
 					{
-						mSocket.close();
+						mSendAckHandler = std::move(sendAckHandler);
 					});
 				}
 
-				void postShutdown(asio::ip::tcp::socket::shutdown_type type) noexcept
+				// replaces the egress rate limit of TcpSessionOption, bytesPerSecond 0 removes it
+				void asyncSetSendRateLimit(size_t bytesPerSecond, size_t burst = 0, bool pacing = false)
 				{
-					asio::post(mSocket.get_executor(), [self = shared_from_this(), this, type]()
+					asio::post(mStrand, [self = shared_from_this(), this, bytesPerSecond, burst, pacing]()
 					{
-						// TODO: maybe need try shutdown 
-						if (mSocket.is_open())
+						setSendRateLimit(bytesPerSecond, burst, pacing);
+						if (mSendRateTimerArmed)
 						{
-							mSocket.shutdown(type);
+							mSendRateTimerArmed = false;
+							mSendRateTimer->cancel();
+							onSendRateRefilled();
 						}
 					});
 				}
 
-				void send(std::shared_ptr<std::string> msg, SendCompletedCallback callback = nullptr) noexcept
+				// stops reading from the socket, so the kernel buffer fills up and tcp flow control reaches the peer
+				// thread safe and idempotent, a receive already in flight still completes and is delivered
+				void pauseRecv()
 				{
-					// TODO: cache it's open status in this class
-					if (!mSocket.is_open())
+					asio::dispatch(mStrand, [self = shared_from_this(), this]()
 					{
-						return;
+						mRecvPausedByUser = true;
+					});
+				}
+
+				void resumeRecv()
+				{
+					asio::dispatch(mStrand, [self = shared_from_this(), this]()
+					{
+						mRecvPausedByUser = false;
+						tryAsyncRecv();
+					});
+				}
+
+				// work the data handler handed on and which isn't finished yet, e.g. queued database requests,
+				// reading pauses at TcpSessionOption::recvPauseWork until it's back to recvResumeWork, thread safe
+				void addRecvWork(size_t count = 1)
+				{
+					const auto oldWork = mRecvWork.fetch_add(count, std::memory_order_relaxed);
+					if (mOption.recvPauseWork > 0 && oldWork < mOption.recvPauseWork && oldWork + count >= mOption.recvPauseWork)
+					{
+						dispatchRecvWorkCheck();
 					}
+				}
 
+				void completeRecvWork(size_t count = 1)
+				{
+					const auto oldWork = mRecvWork.fetch_sub(count, std::memory_order_relaxed);
+					assert(oldWork >= count);
+					if (mOption.recvPauseWork > 0 && oldWork > mOption.recvResumeWork && oldWork - count <= mOption.recvResumeWork)
 					{
-						std::lock_guard<std::mutex> lck(mSendGuard);
-						mPendingSendMsg.push_back({ 0, std::move(msg), std::move(callback) });
+						dispatchRecvWorkCheck();
 					}
+				}
 
-					trySend();
+				size_t pendingRecvWork() const noexcept
+				{
+					return mRecvWork.load(std::memory_order_relaxed);
 				}
 
-				void send(std::string msg, SendCompletedCallback callback = nullptr) noexcept
+				// called by the data handler when it leaves a partial message, bytes is how many more it needs,
+				// the next receive is sized for them and from TcpSessionOption::recvLowWatermarkThreshold on
+				// the socket only becomes readable once they arrived (SO_RCVLOWAT), io thread only
+				void needRecvBytes(size_t bytes) noexcept
 				{
-					send(std::make_shared<std::string>(std::move(msg)), std::move(callback));
+					mRecvNeed = bytes;
 				}
 
-			private:
-				TcpSession(
-					asio::ip::tcp::socket socket,
-					size_t maxRecvBufferSize,
-					DataHandler dataHandler,
-					ClosedHandler closedHandler)
-					:
-					mSocket(std::move(socket)),
-					mSending(false),
-					mDataHandler(std::move(dataHandler)),
-					mReceiveBuffer(std::max<size_t>(MinReceivePrepareSize, maxRecvBufferSize)),
-					mCurrentPrepareSize(std::min<size_t>(MinReceivePrepareSize, maxRecvBufferSize)),
-					mClosedHandler(std::move(closedHandler)),
-					mCurrentTanhXDiff(0)
+				void postClose() noexcept
 				{
-					mSocket.non_blocking(true);
-					mSocket.set_option(asio::ip::tcp::no_delay(true));
+					asio::post(mStrand,
+						[self = shared_from_this(), this]()
+					{
+						mClosed.store(true, std::memory_order_relaxed);
+						mSocket.close();
+					});
 				}
 
-				void tryAsyncRecv()
+				// closes like a receive / send error does, so the closed handler is called, unlike postClose,
+				// runs at once when called in the io thread of the session, e.g. by the data handler
+				void dispatchClose() noexcept
 				{
-					if (mRecvPosted)
+					asio::dispatch(mStrand, [self = shared_from_this(), this]()
 					{
-						return;
-					}
+						causeClosed();
+					});
+				}
 
-					try
+				void postShutdown(asio::ip::tcp::socket::shutdown_type type) noexcept
+				{
+					asio::post(mStrand, [self = shared_from_this(), this, type]()
 					{
-						auto buffer = mReceiveBuffer.prepare(mCurrentPrepareSize - mReceiveBuffer.in_avail());
-						if (buffer.size() == 0)
+						// TODO: maybe need try shutdown 
+						if (mSocket.is_open())
 						{
-							return;
+							mSocket.shutdown(type);
 						}
+					});
+				}
 
-						mSocket.async_receive(
-							std::move(buffer),
-							[self = shared_from_this(), this](std::error_code ec, size_t bytesTransferred)
-						{
-							onRecvCompleted(ec, bytesTransferred);
-						});
-						mRecvPosted = true;
-					}
-					catch (const std::length_error& ec)
-					{
-						std::cout << "do recv, cause error of async receive:" << ec.what() << std::endl;
-						//TODO::callback to user
-					}
+				void send(std::shared_ptr<std::string> msg, SendCompletedCallback callback = nullptr) noexcept
+				{
+					send(std::move(msg), SendOptions(), std::move(callback));
 				}
 
-				void onRecvCompleted(std::error_code ec, size_t bytesTransferred)
+				void send(std::shared_ptr<std::string> msg, const SendOptions& options, SendCompletedCallback callback = nullptr) noexcept
 				{
-					mRecvPosted = false;
+					const auto buffer = asio::buffer(*msg);
+					send(buffer, std::move(msg), options, std::move(callback));
+				}
 
-					if (ec)
-					{
-						causeClosed();
-						return;
-					}
+				void send(std::string msg, SendCompletedCallback callback = nullptr) noexcept
+				{
+					send(std::make_shared<std::string>(std::move(msg)), SendOptions(), std::move(callback));
+				}
 
-					if ((mCurrentPrepareSize - mReceiveBuffer.in_avail()) == bytesTransferred)
-					{
-						const auto TanhXDiff = 0.2;
+				void send(std::string msg, const SendOptions& options, SendCompletedCallback callback = nullptr) noexcept
+				{
+					send(std::make_shared<std::string>(std::move(msg)), options, std::move(callback));
+				}
+
+				// buffer goes back to the slab pool (to the thread cache it came from) once it's sent
+				void send(common::SlabBuffer::Ptr buffer, SendCompletedCallback callback = nullptr) noexcept
+				{
+					send(std::move(buffer), SendOptions(), std::move(callback));
+				}
+
+				void send(common::SlabBuffer::Ptr buffer, const SendOptions& options, SendCompletedCallback callback = nullptr) noexcept
+				{
+					const auto piece = asio::buffer(buffer->data(), buffer->size());
+					send(piece, std::move(buffer), options, std::move(callback));
+				}
 
-						const auto oldTanh = std::tanh(mCurrentTanhXDiff);
-						mCurrentTanhXDiff += TanhXDiff;
-						const auto newTanh = std::tanh(mCurrentTanhXDiff);
-						const auto maxSizeDiff = mReceiveBuffer.max_size() -
-							std::min<size_t>(mReceiveBuffer.max_size(), MinReceivePrepareSize);
-						const auto sizeDiff = maxSizeDiff * (newTanh - oldTanh);
+				// scatter-gather send, pieces go out in one writev without being copied or merged
+				// owner must keep the memory of all pieces alive, it's released after the message is sent
+				template<typename ConstBufferSequence,
+					typename = typename std::enable_if<asio::is_const_buffer_sequence<ConstBufferSequence>::value>::type>
+				void send(const ConstBufferSequence& pieces, SendOwner owner, SendCompletedCallback callback = nullptr) noexcept
+				{
+					send(pieces, std::move(owner), SendOptions(), std::move(callback));
+				}
 
-						mCurrentPrepareSize += sizeDiff;
-						mCurrentPrepareSize = std::min<size_t>(mCurrentPrepareSize, mReceiveBuffer.max_size());
-					}
+				template<typename ConstBufferSequence,
+					typename = typename std::enable_if<asio::is_const_buffer_sequence<ConstBufferSequence>::value>::type>
+				void send(const ConstBufferSequence& pieces, SendOwner owner, const SendOptions& options, SendCompletedCallback callback = nullptr) noexcept
+				{
+					sendPieces(SendPieces(pieces), std::move(owner), options, std::move(callback));
+				}
 
-					mReceiveBuffer.commit(bytesTransferred);
+				void send(std::initializer_list<asio::const_buffer> pieces, SendOwner owner, SendCompletedCallback callback = nullptr) noexcept
+				{
+					send<std::initializer_list<asio::const_buffer>>(pieces, std::move(owner), SendOptions(), std::move(callback));
+				}
 
-					tryProcessRecvBuffer();
-					tryAsyncRecv();
+				void send(std::initializer_list<asio::const_buffer> pieces, SendOwner owner, const SendOptions& options, SendCompletedCallback callback = nullptr) noexcept
+				{
+					send<std::initializer_list<asio::const_buffer>>(pieces, std::move(owner), options, std::move(callback));
 				}
 
-				void tryProcessRecvBuffer()
+				void send(const SendPieces& pieces, SendOwner owner, SendCompletedCallback callback = nullptr) noexcept
 				{
-					if (mDataHandler == nullptr)
+					sendPieces(pieces, std::move(owner), SendOptions(), std::move(callback));
+				}
+
+				void send(const SendPieces& pieces, SendOwner owner, const SendOptions& options, SendCompletedCallback callback = nullptr) noexcept
+				{
+					sendPieces(pieces, std::move(owner), options, std::move(callback));
+				}
+
+				// sends length bytes of fd starting at offset, ordered with the messages queued before and after it,
+				// on linux the data goes from page cache to socket by sendfile(2) without entering userspace
+				// fd must stay open until callback is called, the session is closed if the file is shorter than length
+				void sendFile(int fd, uint64_t offset, size_t length, SendCompletedCallback callback = nullptr) noexcept
+				{
+					sendFile(fd, offset, length, SendOptions(), std::move(callback));
+				}
+
+				void sendFile(int fd, uint64_t offset, size_t length, const SendOptions& options, SendCompletedCallback callback = nullptr) noexcept
+				{
+					if (!mSocket.is_open())
 					{
 						return;
 					}
 
-					const auto validReadBuffer = mReceiveBuffer.data();
-					const auto procLen = mDataHandler(shared_from_this(), static_cast<const char*>(validReadBuffer.data()), validReadBuffer.size());
-					assert(procLen <= validReadBuffer.size());
+					auto pending = new PendingMsg;
+					pending->fileFd = fd;
+					pending->fileOffset = offset;
+					pending->fileLength = length;
+					pending->callback = std::move(callback);
+					pending->apply(options);
+					pushPendingMsg(pending);
+				}
 
-					if (procLen <= validReadBuffer.size())
-					{
-						mReceiveBuffer.consume(procLen);
-					}
-					else
+				// streams a payload of any size without building it in memory,
+				// the io thread calls producer for the next chunk whenever less than streamPullThreshold bytes
+				// of this stream are queued, so memory stays at a few chunks and the pace follows the socket
+				// the stream is ordered with the messages queued before and after it in options.lane,
+				// which is the only option used, callback is called after the last chunk is sent
+				// producer runs in the io thread while a write is built, it may call send / sendFile / sendStream,
+				// which are flushed after it returns, it must not block or wait for its own messages
+				void sendStream(StreamProducer producer, const SendOptions& options = SendOptions(), SendCompletedCallback callback = nullptr) noexcept
+				{
+					if (!mSocket.is_open())
 					{
-						; // throw
+						return;
 					}
+
+					auto pending = new PendingMsg;
+					pending->stream = std::make_shared<StreamSource>();
+					pending->stream->producer = std::move(producer);
+					pending->callback = std::move(callback);
+					pending->lane = options.lane;
+					pushPendingMsg(pending);
 				}
 
-				void causeClosed()
+			private:
+				friend TcpSessionGroup;
+				friend TcpWriteScheduler<TcpSession>;
+
+				// shared by the send overloads
+				void sendPieces(SendPieces pieces, SendOwner owner, const SendOptions& options, SendCompletedCallback callback) noexcept
 				{
-					// already closed
+					// TODO: cache it's open status in this class
 					if (!mSocket.is_open())
 					{
 						return;
 					}
 
-					mSocket.close();
-					if (mClosedHandler != nullptr)
-					{
-						mClosedHandler(shared_from_this());
-					}
+					auto pending = new PendingMsg;
+					pending->pieces = std::move(pieces);
+					pending->owner = std::move(owner);
+					pending->callback = std::move(callback);
+					pending->apply(options);
+					pushPendingMsg(pending);
 				}
 
-				void trySend()
+				// io thread only, appends without going through mSendQueue
+				void sendInLoop(const SendPieces& pieces, const SendOwner& owner, const SendOptions& options)
 				{
-					std::lock_guard<std::mutex> lck(mSendGuard);
-					if (mSending || mPendingSendMsg.empty())
+					if (!mSocket.is_open())
 					{
 						return;
 					}
 
-					mBuffers.resize(mPendingSendMsg.size());
-					for (size_t i = 0; i < mPendingSendMsg.size(); ++i)
+					// keep the order with messages this thread has already pushed
+					appendPendingMsg(mSendQueue.popAll());
+
+					auto pending = new PendingMsg;
+					pending->pieces = pieces;
+					pending->owner = owner;
+					pending->apply(options);
+					pending->zeroCopy = useZeroCopy(*pending);
+					accountQueuedMsg(pending->bytes());
+					appendPendingMsg(pending);
+					if (mOption.deferSendFlush)
 					{
-						auto& msg = mPendingSendMsg[i];
-						mBuffers[i] = asio::const_buffer(msg.msg->c_str() + msg.sendPos, msg.msg->size() - msg.sendPos);
+						scheduleSendFlush();
+						return;
+					}
+					trySend(true);
+					checkSendWatermark();
+				}
+
+				// returns true if the queue crosses a watermark or the slow consumer limit
+				bool accountQueuedMsg(size_t bytes) noexcept
+				{
+					const auto oldBytes = mQueuedBytes.fetch_add(bytes, std::memory_order_relaxed);
+					const auto oldMessages = mQueuedMessages.fetch_add(1, std::memory_order_relaxed);
+
+					const auto crossed = [](size_t oldValue, size_t diff, size_t threshold)
+					{
+						return threshold > 0 && oldValue < threshold && oldValue + diff >= threshold;
+					};
+					return crossed(oldBytes, bytes, mOption.sendHighWatermarkBytes) ||
+						crossed(oldMessages, 1, mOption.sendHighWatermarkMessages) ||
+						crossed(oldBytes, bytes, mOption.slowConsumerBytes);
+				}
+
+				bool useZeroCopy(const PendingMsg& pending) const noexcept
+				{
+					return mZeroCopyEnabled && !pending.isFile() && pending.bytes() >= mOption.zeroCopyThreshold;
+				}
+
+				void pushPendingMsg(PendingMsg* pending) noexcept
+				{
+					pending->zeroCopy = useZeroCopy(*pending);
+					const auto needCheck = accountQueuedMsg(pending->bytes());
+
+					// only the push which makes the queue non-empty needs to wake up the io thread,
+					// the others will be drained together with it
+					if (!mSendQueue.push(pending))
+					{
+						// the io thread may be stuck behind a slow reader, tell it about the watermark now
+						if (needCheck)
+						{
+							asio::post(mStrand, [self = shared_from_this(), this]()
+							{
+								checkSendWatermark();
+							});
+						}
+						return;
+					}
+
+					if (mStrand.running_in_this_thread())
+					{
+						if (mPullingStream)
+						{
+							asio::post(mStrand, [self = shared_from_this(), this]()
+							{
+								flushSendQueue();
+							});
+							return;
+						}
+						flushInLoop();
+					}
+					else if (mIoContext.get_executor().running_in_this_thread())
+					{
+						// a handler of another session, still inline unless another thread is inside the strand
+						asio::dispatch(mStrand, [self = shared_from_this(), this]()
+						{
+							flushInLoop();
+						});
+					}
+					else if (mOption.deferSendFlush && mOption.sendFlushDelay.count() > 0)
+					{
+						asio::post(mStrand, [self = shared_from_this(), this]()
+						{
+							scheduleSendFlush();
+						});
+					}
+					else
+					{
+						asio::post(mStrand, [self = shared_from_this(), this]()
+						{
+							flushSendQueue();
+						});
+					}
+				}
+
+				void flushInLoop()
+				{
+					if (mOption.deferSendFlush)
+					{
+						scheduleSendFlush();
+					}
+					else
+					{
+						flushSendQueue(true);
+					}
+				}
+
+				// io thread only, flushes at the end of this loop turn or after sendFlushDelay,
+				// everything sent until then goes out in one writev
+				void scheduleSendFlush()
+				{
+					if (mSendFlushScheduled)
+					{
+						return;
+					}
+
+					mSendFlushScheduled = true;
+					if (mOption.sendFlushDelay.count() <= 0)
+					{
+						asio::post(mStrand, [self = shared_from_this(), this]()
+						{
+							mSendFlushScheduled = false;
+							flushSendQueue();
+						});
+						return;
+					}
+
+					if (mSendFlushTimer == nullptr)
+					{
+						mSendFlushTimer = std::make_unique<asio::steady_timer>(mIoContext);
+					}
+					mSendFlushTimer->expires_after(mOption.sendFlushDelay);
+					mSendFlushTimer->async_wait(asio::bind_executor(mStrand, [self = shared_from_this(), this](const asio::error_code& ec)
+					{
+						mSendFlushScheduled = false;
+						if (!ec)
+						{
+							flushSendQueue();
+						}
+					}));
+				}
+
+				TcpSession(
+					asio::ip::tcp::socket socket,
+					size_t maxRecvBufferSize,
+					DataHandler dataHandler,
+					ClosedHandler closedHandler,
+					const TcpSessionOption& option)
+					:
+					mSocket(std::move(socket)),
+					mIoContext(static_cast<asio::io_context&>(mSocket.get_executor().context())),
+					mStrand(mIoContext.get_executor()),
+					mSending(false),
+					mOption(normalizeOption(option)),
+					mDataHandler(std::move(dataHandler)),
+					mFraming(mOption.frameCodec.headerSize > 0 && mOption.frameHandler != nullptr),
+					mMaxRecvBufferSize(std::max<size_t>(MinReceivePrepareSize, std::max<size_t>(maxRecvBufferSize,
+						mFraming ? mOption.frameCodec.headerSize + mOption.frameCodec.maxFrameSize : 0))),
+					mReceiveBuffer(mOption.recvOnReadable ? nullptr : makeRecvBuffer()),
+					mMinPrepareSize(std::min<size_t>(MinReceivePrepareSize, maxRecvBufferSize)),
+					mCurrentPrepareSize(mMinPrepareSize),
+					mRecvBufferSizer(option.recvBufferSizer != nullptr ?
+						option.recvBufferSizer(MinReceivePrepareSize, mMaxRecvBufferSize) :
+						std::make_unique<TanhRecvBufferSizer>(MinReceivePrepareSize, mMaxRecvBufferSize)),
+					mClosedHandler(std::move(closedHandler))
+				{
+					mSocket.non_blocking(true);
+					mSocket.set_option(asio::ip::tcp::no_delay(true));
+
+					if (mOption.zeroCopyThreshold > 0)
+					{
+						mZeroCopyEnabled = ZeroCopyTracker::enable(mSocket.native_handle());
+					}
+					setSendRateLimit(mOption.sendRateLimit, mOption.sendRateBurst, mOption.sendPacing);
+				}
+
+				void setSendRateLimit(size_t bytesPerSecond, size_t burst, bool pacing)
+				{
+					// SO_MAX_PACING_RATE with ~0U means unlimited
+					const auto pacingRate = pacing && bytesPerSecond > 0 ? bytesPerSecond : ~0U;
+					if (pacing || mSendPacing)
+					{
+						mSendPacing = setPacingRate(pacingRate) && pacing && bytesPerSecond > 0;
+					}
+
+					// falls back to the token bucket where the kernel can't pace
+					mSendRate.reset(mSendPacing ? 0 : bytesPerSecond, burst, common::TokenBucket::Clock::now());
+				}
+
+				bool setPacingRate(size_t bytesPerSecond) noexcept
+				{
+#if defined(__linux__) && defined(SO_MAX_PACING_RATE)
+					const auto rate = static_cast<unsigned int>(std::min<size_t>(bytesPerSecond, ~0U));
+					return ::setsockopt(mSocket.native_handle(), SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) == 0;
+#else
+					(void)bytesPerSecond;
+					return false;
+#endif
+				}
+
+				static TcpSessionOption normalizeOption(TcpSessionOption option)
+				{
+					option.maxSendBuffers = std::max<size_t>(1, std::min<size_t>(option.maxSendBuffers, MaxSendBuffers));
+					option.sendCoalesceThreshold = std::min<size_t>(option.sendCoalesceThreshold, option.sendStagingSize);
+					option.streamPullThreshold = std::max<size_t>(1, option.streamPullThreshold);
+					option.recvResumeWork = std::min(option.recvResumeWork, option.recvPauseWork > 0 ? option.recvPauseWork - 1 : 0);
+					option.frameCodec.headerSize = std::min(option.frameCodec.headerSize, static_cast<size_t>(FrameCodec::MaxHeaderSize));
+					return option;
+				}
+
+				std::unique_ptr<RecvBuffer> makeRecvBuffer() const
+				{
+					if (mOption.recvBuffer != nullptr)
+					{
+						return mOption.recvBuffer(mMaxRecvBufferSize);
+					}
+					return std::make_unique<StreambufRecvBuffer>(mMaxRecvBufferSize);
+				}
+
+				// shared by the sessions of a thread in recvOnReadable mode, only valid during one data handler call
+				static std::vector<char>& recvScratch()
+				{
+					thread_local std::vector<char> scratch;
+					return scratch;
+				}
+
+				void tryAsyncRecv()
+				{
+					// e.g. closed by the data handler, no buffer is prepared for a receive which fails anyway
+					if (mRecvPosted || !mSocket.is_open() || recvPaused())
+					{
+						return;
+					}
+
+					const auto toScratch = recvToScratchNext();
+					if (toScratch || (mRecvCaughtUp && mReceiveBuffer->size() == 0))
+					{
+						// nothing to keep, so no buffer is held or prepared while waiting
+						if (toScratch)
+						{
+							mReceiveBuffer.reset();
+						}
+						else
+						{
+							armRecvIdleTimer();
+						}
+						updateRecvLowWatermark(mCurrentPrepareSize);
+						mSocket.async_wait(asio::ip::tcp::socket::wait_read,
+							asio::bind_executor(mStrand, [self = shared_from_this(), this](std::error_code ec)
+						{
+							onReadable(ec);
+						}));
+						mRecvPosted = true;
+						return;
+					}
+
+					auto buffer = prepareRecv();
+					if (buffer.size() == 0)
+					{
+						return;
+					}
+					updateRecvLowWatermark(buffer.size());
+
+					mSocket.async_receive(
+						std::move(buffer),
+						asio::bind_executor(mStrand, [self = shared_from_this(), this](std::error_code ec, size_t bytesTransferred)
+					{
+						onRecvCompleted(ec, bytesTransferred);
+					}));
+					mRecvPosted = true;
+				}
+
+				bool recvPaused() const noexcept
+				{
+					return mRecvPausedByUser || mRecvPausedByWork;
+				}
+
+				// dispatched, so work added by the data handler pauses before the session reads again
+				void dispatchRecvWorkCheck()
+				{
+					asio::dispatch(mStrand, [self = shared_from_this(), this]()
+					{
+						// the counter may have moved again since, it's read now
+						const auto work = mRecvWork.load(std::memory_order_relaxed);
+						if (!mRecvPausedByWork && work >= mOption.recvPauseWork)
+						{
+							mRecvPausedByWork = true;
+						}
+						else if (mRecvPausedByWork && work <= mOption.recvResumeWork)
+						{
+							mRecvPausedByWork = false;
+							tryAsyncRecv();
+						}
+					});
+				}
+
+				// recvOnReadable with nothing kept, the next read goes to the scratch buffer
+				bool recvToScratchNext() const noexcept
+				{
+					return mOption.recvOnReadable && (mReceiveBuffer == nullptr || mReceiveBuffer->size() == 0);
+				}
+
+				// a wakeup per partial message instead of per tcp segment, SO_RCVLOWAT is only changed when needed
+				void updateRecvLowWatermark(size_t readSize)
+				{
+					if (mOption.recvLowWatermarkThreshold == 0)
+					{
+						return;
+					}
+
+					const auto lowWatermark = static_cast<int>(std::min<size_t>(
+						mRecvNeed >= mOption.recvLowWatermarkThreshold ? std::min(mRecvNeed, readSize) : 1,
+						std::numeric_limits<int>::max()));
+					if (lowWatermark == mRecvLowWatermark)
+					{
+						return;
+					}
+
+					std::error_code ec;
+					mSocket.set_option(asio::socket_base::receive_low_watermark(lowWatermark), ec);
+					if (!ec)
+					{
+						mRecvLowWatermark = lowWatermark;
+					}
+				}
+
+				// empty when the buffer is full
+				asio::mutable_buffer prepareRecv()
+				{
+					try
+					{
+						// a shrunk target may be below the bytes kept for a partial message, still read some more,
+						// all of the rest of the message if the data handler told how much that is
+						const auto size = mReceiveBuffer->size();
+						const auto target = std::max(mCurrentPrepareSize,
+							std::min(mMaxRecvBufferSize, size + std::max(mMinPrepareSize, mRecvNeed)));
+						auto buffer = mReceiveBuffer->prepare(target - size);
+						mRecvPreparedSize = buffer.size();
+						return buffer;
+					}
+					catch (const std::length_error& ec)
+					{
+						std::cout << "do recv, cause error of async receive:" << ec.what() << std::endl;
+						//TODO::callback to user
+					}
+					return asio::mutable_buffer();
+				}
+
+				void onRecvCompleted(std::error_code ec, size_t bytesTransferred)
+				{
+					mRecvPosted = false;
+
+					if (ec)
+					{
+						causeClosed();
+						return;
+					}
+
+					const auto filled = bytesTransferred == mRecvPreparedSize;
+					onRecvBuffered(bytesTransferred, filled);
+					drainRecv(bytesTransferred, filled);
+					tryAsyncRecv();
+				}
+
+				// recvOnReadable: reads into the scratch buffer of the thread,
+				// only what the data handler leaves is copied into a buffer of the session
+				// otherwise the session was caught up and reads into its buffer now
+				void onReadable(std::error_code ec)
+				{
+					mRecvPosted = false;
+
+					if (ec)
+					{
+						causeClosed();
+						return;
+					}
+					// paused while waiting, the data stays in the kernel, resumeRecv waits again
+					if (recvPaused())
+					{
+						return;
+					}
+
+					size_t bytesTransferred = 0;
+					auto filled = false;
+					ec = recvToScratchNext() ?
+						recvToScratch(bytesTransferred, filled) :
+						recvToBuffer(bytesTransferred, filled);
+					if (ec && !isWouldBlock(ec))
+					{
+						causeClosed();
+						return;
+					}
+
+					if (!ec)
+					{
+						drainRecv(bytesTransferred, filled);
+					}
+					tryAsyncRecv();
+				}
+
+				static bool isWouldBlock(const std::error_code& ec) noexcept
+				{
+					return ec == asio::error::would_block || ec == asio::error::try_again;
+				}
+
+				// reads into the buffer of the session without waiting, no_buffer_space when it's full
+				std::error_code recvToBuffer(size_t& bytesTransferred, bool& filled)
+				{
+					const auto buffer = prepareRecv();
+					if (buffer.size() == 0)
+					{
+						return asio::error::no_buffer_space;
+					}
+
+					std::error_code ec;
+					bytesTransferred = mSocket.receive(buffer, 0, ec);
+					if (!ec)
+					{
+						filled = bytesTransferred == buffer.size();
+						onRecvBuffered(bytesTransferred, filled);
+					}
+					return ec;
+				}
+
+				void onRecvBuffered(size_t bytesTransferred, bool filled)
+				{
+					updatePrepareSize(bytesTransferred, filled);
+
+					mReceiveBuffer->commit(bytesTransferred);
+
+					tryProcessRecvBuffer();
+					mRecvCaughtUp = !filled && mReceiveBuffer->size() == 0;
+					if (mRecvCaughtUp)
+					{
+						mRecvCaughtUpAt = std::chrono::steady_clock::now();
+					}
+					tryReclaimRecvBuffer();
+				}
+
+				std::error_code recvToScratch(size_t& bytesTransferred, bool& filled)
+				{
+					auto& scratch = recvScratch();
+					const auto readSize = mCurrentPrepareSize;
+					if (scratch.size() < readSize)
+					{
+						scratch.resize(readSize);
+					}
+
+					std::error_code ec;
+					bytesTransferred = mSocket.receive(asio::buffer(scratch.data(), readSize), 0, ec);
+					if (ec)
+					{
+						return ec;
+					}
+
+					filled = bytesTransferred == readSize;
+					updatePrepareSize(bytesTransferred, filled);
+
+					const auto procLen = processRecvData(scratch.data(), bytesTransferred);
+					if (procLen < bytesTransferred)
+					{
+						// a partial message, the next reads go to the buffer of the session until it's consumed
+						if (mReceiveBuffer == nullptr)
+						{
+							mReceiveBuffer = makeRecvBuffer();
+						}
+						const auto rest = bytesTransferred - procLen;
+						asio::buffer_copy(mReceiveBuffer->prepare(rest), asio::buffer(scratch.data() + procLen, rest));
+						mReceiveBuffer->commit(rest);
+					}
+					return ec;
+				}
+
+				// recvDrainBytes: after a read which filled its buffer the socket likely has more,
+				// it's read right away with non-blocking reads instead of another round through the io_context,
+				// until a read comes back short or would block, or the budget of this wakeup is used up
+				void drainRecv(size_t received, bool filled)
+				{
+					for (size_t reads = 1;
+						filled && received < mOption.recvDrainBytes && reads < mOption.recvDrainReads && mSocket.is_open() && !recvPaused();
+						reads++)
+					{
+						size_t bytesTransferred = 0;
+						const auto ec = recvToScratchNext() ?
+							recvToScratch(bytesTransferred, filled) :
+							recvToBuffer(bytesTransferred, filled);
+						if (isWouldBlock(ec) || ec == asio::error::no_buffer_space)
+						{
+							return;
+						}
+						if (ec)
+						{
+							causeClosed();
+							return;
+						}
+						received += bytesTransferred;
+					}
+				}
+
+				void updatePrepareSize(size_t bytesTransferred, bool filled)
+				{
+					mCurrentPrepareSize = std::min(mMaxRecvBufferSize,
+						std::max(mMinPrepareSize, mRecvBufferSizer->next(mCurrentPrepareSize, bytesTransferred, filled)));
+				}
+
+				// once the sizer went well below what a past burst used, the buffer gives that memory back
+				void tryReclaimRecvBuffer()
+				{
+					if (mRecvPosted || mReceiveBuffer == nullptr)
+					{
+						return;
+					}
+
+					mReceiveBuffer->reclaim(mCurrentPrepareSize);
+				}
+
+				// the sizer may still want a large buffer for the next burst, so it isn't given back right away,
+				// which would reallocate it on every short read of a stream, but only after a quiet recvIdleReclaim
+				void armRecvIdleTimer()
+				{
+					if (mOption.recvIdleReclaim.count() <= 0 || mRecvIdleTimerArmed || mCurrentPrepareSize <= mMinPrepareSize)
+					{
+						return;
+					}
+
+					if (mRecvIdleTimer == nullptr)
+					{
+						mRecvIdleTimer = std::make_unique<asio::steady_timer>(mIoContext);
+					}
+					mRecvIdleTimerArmed = true;
+					mRecvIdleTimer->expires_at(mRecvCaughtUpAt + mOption.recvIdleReclaim);
+					mRecvIdleTimer->async_wait(asio::bind_executor(mStrand, [self = shared_from_this(), this](const asio::error_code& ec)
+					{
+						mRecvIdleTimerArmed = false;
+						if (ec || !mRecvCaughtUp || mReceiveBuffer == nullptr)
+						{
+							return;
+						}
+
+						// reads went on meanwhile, the quiet time starts at the last one
+						if (std::chrono::steady_clock::now() - mRecvCaughtUpAt < mOption.recvIdleReclaim)
+						{
+							armRecvIdleTimer();
+							return;
+						}
+
+						// no receive holds the buffer while caught up
+						mReceiveBuffer->reclaim(mMinPrepareSize);
+					}));
+				}
+
+				void tryProcessRecvBuffer()
+				{
+					if (mReceiveBuffer == nullptr)
+					{
+						return;
+					}
+
+					const auto validReadBuffer = mReceiveBuffer->data();
+					const auto procLen = processRecvData(static_cast<const char*>(validReadBuffer.data()), validReadBuffer.size());
+					mReceiveBuffer->consume(procLen);
+				}
+
+				// hands received bytes to the frame handler or the data handler, returns the bytes consumed
+				size_t processRecvData(const char* data, size_t size)
+				{
+					mRecvNeed = 0;
+					if (!mFraming)
+					{
+						if (mDataHandler == nullptr)
+						{
+							return 0;
+						}
+
+						const auto procLen = mDataHandler(shared_from_this(), data, size);
+						assert(procLen <= size);
+						return std::min(procLen, size);
+					}
+
+					const auto self = shared_from_this();
+					auto oversized = false;
+					const auto procLen = FrameCodec::decode(mOption.frameCodec, data, size,
+						[this, &self](const char* frame, size_t frameSize)
+					{
+						mOption.frameHandler(self, frame, frameSize);
+					}, oversized);
+					if (oversized)
+					{
+						// before the receive buffer grows for it
+						causeClosed();
+					}
+					else
+					{
+						mRecvNeed = FrameCodec::missing(mOption.frameCodec, data + procLen, size - procLen);
+					}
+					return procLen;
+				}
+
+				void causeClosed()
+				{
+					// already closed
+					if (!mSocket.is_open())
+					{
+						return;
+					}
+
+					mClosed.store(true, std::memory_order_relaxed);
+					mSocket.close();
+					if (mSlowConsumerTimer != nullptr)
+					{
+						mSlowConsumerTimerArmed = false;
+						mSlowConsumerTimer->cancel();
+					}
+					if (mSendRateTimer != nullptr)
+					{
+						mSendRateTimerArmed = false;
+						mSendRateTimer->cancel();
+					}
+					if (mSendFlushTimer != nullptr)
+					{
+						mSendFlushTimer->cancel();
+					}
+					if (mRecvIdleTimer != nullptr)
+					{
+						mRecvIdleTimerArmed = false;
+						mRecvIdleTimer->cancel();
+					}
+					if (mClosedHandler != nullptr)
+					{
+						mClosedHandler(shared_from_this());
+					}
+				}
+
+				// inlineWrite: called by send in the io thread, see sendInline
+				void flushSendQueue(bool inlineWrite = false)
+				{
+					if (mSendShutdown)
+					{
+						// messages the write in flight didn't reach went back to their lanes
+						dropPendingMsg();
+						trySendShutdown();
+						return;
+					}
+
+					appendPendingMsg(mSendQueue.popAll());
+					trySend(inlineWrite);
+					checkSendWatermark();
+				}
+
+				void checkSendWatermark()
+				{
+					const auto bytes = mQueuedBytes.load(std::memory_order_relaxed);
+					const auto messages = mQueuedMessages.load(std::memory_order_relaxed);
+
+					if (!mAboveHighWatermark)
+					{
+						if ((mOption.sendHighWatermarkBytes > 0 && bytes >= mOption.sendHighWatermarkBytes) ||
+							(mOption.sendHighWatermarkMessages > 0 && messages >= mOption.sendHighWatermarkMessages))
+						{
+							mAboveHighWatermark = true;
+							if (mOption.highWatermarkHandler != nullptr)
+							{
+								mOption.highWatermarkHandler(shared_from_this(), bytes, messages);
+							}
+						}
+					}
+					// a dimension without high watermark isn't watched, its low watermark of 0 would wait for an empty queue
+					else if ((mOption.sendHighWatermarkBytes == 0 || bytes <= mOption.sendLowWatermarkBytes) &&
+						(mOption.sendHighWatermarkMessages == 0 || messages <= mOption.sendLowWatermarkMessages))
+					{
+						mAboveHighWatermark = false;
+						if (mOption.lowWatermarkHandler != nullptr)
+						{
+							mOption.lowWatermarkHandler(shared_from_this(), bytes, messages);
+						}
+					}
+
+					if (mOption.slowConsumerPolicy == SlowConsumerPolicy::None || mOption.slowConsumerBytes == 0)
+					{
+						return;
+					}
+
+					if (mSendShutdown)
+					{
+						return;
+					}
+					if (bytes >= mOption.slowConsumerBytes && !mSlowConsumerTimerArmed)
+					{
+						armSlowConsumerTimer();
+					}
+					else if (bytes < mOption.slowConsumerBytes && mSlowConsumerTimerArmed)
+					{
+						mSlowConsumerTimerArmed = false;
+						mSlowConsumerTimer->cancel();
+					}
+				}
+
+				void armSlowConsumerTimer()
+				{
+					if (mSlowConsumerTimer == nullptr)
+					{
+						mSlowConsumerTimer = std::make_unique<asio::steady_timer>(mIoContext);
+					}
+
+					mSlowConsumerTimerArmed = true;
+					mSlowConsumerTimer->expires_after(mOption.slowConsumerTimeout);
+					mSlowConsumerTimer->async_wait(asio::bind_executor(mStrand, [self = shared_from_this(), this](const asio::error_code& ec)
+					{
+						if (ec || !mSlowConsumerTimerArmed)
+						{
+							return;
+						}
+
+						mSlowConsumerTimerArmed = false;
+						if (mSendShutdown || mQueuedBytes.load(std::memory_order_relaxed) >= mOption.slowConsumerBytes)
+						{
+							onSlowConsumer();
+						}
+					}));
+				}
+
+				void onSlowConsumer()
+				{
+					// a peer which doesn't even complete the write in flight within another timeout is reset
+					if (mOption.slowConsumerPolicy == SlowConsumerPolicy::Close || mSendShutdown)
+					{
+						asio::error_code ec;
+						mSocket.set_option(asio::socket_base::linger(true, 0), ec);
+						causeClosed();
+						return;
+					}
+
+					// a message which has started sending is finished first, so the peer never gets half of it
+					mSendShutdown = true;
+					dropPendingMsg();
+					armSlowConsumerTimer();
+					trySendShutdown();
+				}
+
+				// finishes the partially sent message, if any, then shuts down the send side and closes
+				void trySendShutdown()
+				{
+					if (mSending)
+					{
+						return;
+					}
+					if (!mSendingMsg.empty())
+					{
+						trySend();
+						return;
+					}
+
+					asio::error_code ec;
+					mSocket.shutdown(asio::ip::tcp::socket::shutdown_send, ec);
+					causeClosed();
+				}
+
+				// discards queued messages, except the ones covered by the writev in flight
+				// and a partially sent one, which must complete to keep the byte stream framing
+				void dropPendingMsg() noexcept
+				{
+					appendPendingMsg(mSendQueue.popAll());
+
+					for (size_t i = 0; i < SendLaneCount; i++)
+					{
+						mConflation[i].clear();
+						auto dropped = mPendingSendMsg[i].release();
+						while (dropped != nullptr)
+						{
+							auto nextMsg = SendQueue::next(dropped);
+							mQueuedBytes.fetch_sub(dropped->bytes(), std::memory_order_relaxed);
+							mQueuedMessages.fetch_sub(1, std::memory_order_relaxed);
+							delete dropped;
+							dropped = nextMsg;
+						}
+					}
+				}
+
+				// appends a chain of messages linked by mpscNext to their lanes
+				void appendPendingMsg(PendingMsg* msg)
+				{
+					while (msg != nullptr)
+					{
+						const auto nextMsg = SendQueue::next(msg);
+						if (!conflate(msg))
+						{
+							mPendingSendMsg[static_cast<size_t>(msg->lane)].pushBack(msg);
+						}
+						msg = nextMsg;
+					}
+				}
+
+				// a queued message of the same lane and key takes the content of msg and keeps its place,
+				// returns true if msg was merged into it and deleted, the replaced content is discarded without callback
+				bool conflate(PendingMsg* msg)
+				{
+					if (msg->conflationKey == 0)
+					{
+						return false;
+					}
+
+					auto& slot = mConflation[static_cast<size_t>(msg->lane)][msg->conflationKey];
+					if (slot == nullptr)
+					{
+						slot = msg;
+						return false;
+					}
+
+					const auto queued = slot;
+					mQueuedBytes.fetch_sub(queued->bytes(), std::memory_order_relaxed);
+					mQueuedMessages.fetch_sub(1, std::memory_order_relaxed);
+					mConflatedMessages++;
+
+					const auto nextMsg = queued->mpscNext;
+					*queued = std::move(*msg);
+					queued->mpscNext = nextMsg;
+					delete msg;
+					return true;
+				}
+
+				// pops the head of lane, which can't be conflated any more
+				PendingMsg* takePendingMsg(PendingList& lane) noexcept
+				{
+					const auto msg = lane.popFront();
+					if (msg->conflationKey != 0)
+					{
+						mConflation[static_cast<size_t>(msg->lane)].erase(msg->conflationKey);
+					}
+					return msg;
+				}
+
+				// highest lane with a message, nullptr if all are empty
+				// expired messages at the head of a lane are dropped on the way, they haven't started sending,
+				// a stream at the head pulls its next chunks, a lane whose stream has enough outstanding is skipped
+				PendingList* nextSendLane()
+				{
+					for (auto& lane : mPendingSendMsg)
+					{
+						while (!lane.empty() && lane.head->isExpired())
+						{
+							const auto expired = takePendingMsg(lane);
+							mQueuedBytes.fetch_sub(expired->bytes(), std::memory_order_relaxed);
+							mQueuedMessages.fetch_sub(1, std::memory_order_relaxed);
+							mExpiredMessages++;
+							delete expired;
+						}
+
+						if (!lane.empty() && (!lane.head->isStream() || pullStream(lane)))
+						{
+							return &lane;
+						}
+					}
+					return nullptr;
+				}
+
+				// the stream is the head of lane, puts its next chunks in front of it,
+				// at the end of the stream it becomes an empty message which completes after the last chunk,
+				// returns false if nothing can be sent from lane yet
+				bool pullStream(PendingList& lane)
+				{
+					const auto node = lane.head;
+					const auto source = node->stream;
+
+					PendingList pulled;
+					StreamChunk chunk;
+					while (source->outstanding < mOption.streamPullThreshold)
+					{
+						chunk.pieces.clear();
+						chunk.owner.reset();
+						mPullingStream = true;
+						const auto more = source->producer(chunk);
+						mPullingStream = false;
+						if (!more)
+						{
+							node->stream.reset();
+							break;
+						}
+
+						auto pending = new PendingMsg;
+						pending->pieces = std::move(chunk.pieces);
+						pending->owner = std::move(chunk.owner);
+						pending->lane = node->lane;
+						pending->stream = source;
+						pending->streamChunk = true;
+						source->outstanding += pending->bytes();
+						accountQueuedMsg(pending->bytes());
+						pulled.pushBack(pending);
+					}
+
+					lane.prepend(pulled);
+					return !lane.head->isStream();
+				}
+
+				bool hasSendMsg()
+				{
+					return !mSendingMsg.empty() || nextSendLane() != nullptr;
+				}
+
+				void trySend(bool inlineWrite = false)
+				{
+					if (mSending)
+					{
+						return;
+					}
+
+					if (mOption.writeQuantum == 0)
+					{
+						startSend(inlineWrite);
+						return;
+					}
+
+					if (!hasSendMsg())
+					{
+						// an idle session doesn't keep its deficit
+						mWriteDeficit = 0;
+						return;
+					}
+					if (!mWriteScheduled)
+					{
+						mWriteScheduled = true;
+						TcpWriteScheduler<TcpSession>::Of(mIoContext).schedule(shared_from_this());
+					}
+				}
+
+				void onWriteTurn()
+				{
+					mWriteScheduled = false;
+					if (mSending || !hasSendMsg())
+					{
+						mWriteDeficit = 0;
+						return;
+					}
+
+					// credit left over from a short write is kept for one turn at most,
+					// a session whose peer reads slowly can't save up a burst
+					mWriteDeficit = std::min(mWriteDeficit, mOption.writeQuantum) + mOption.writeQuantum;
+					startSend();
+				}
+
+				// bytes the next write may carry
+				size_t sendBudget() const noexcept
+				{
+					const auto budget = mOption.writeQuantum > 0 ? mWriteDeficit : std::numeric_limits<size_t>::max();
+					return mSendRate.enabled() ? std::min(budget, mSendRateBudget) : budget;
+				}
+
+				// takes the tokens available for the next write,
+				// returns false and waits for the bucket to refill if there are too few
+				bool acquireSendRate()
+				{
+					if (mSendRateTimerArmed)
+					{
+						return false;
+					}
+
+					const auto now = common::TokenBucket::Clock::now();
+					const auto minWrite = std::min(MinRateLimitedWrite, mSendRate.burst());
+					mSendRateBudget = mSendRate.available(now);
+					if (mSendRateBudget >= minWrite)
+					{
+						return true;
+					}
+
+					if (mSendRateTimer == nullptr)
+					{
+						mSendRateTimer = std::make_unique<asio::steady_timer>(mIoContext);
+					}
+					if (!mSendRateResumed)
+					{
+						mThrottledSince = now;
+					}
+
+					mSendRateTimerArmed = true;
+					mSendRateTimer->expires_after(mSendRate.timeUntil(minWrite, now));
+					mSendRateTimer->async_wait(asio::bind_executor(mStrand, [self = shared_from_this(), this](const asio::error_code& ec)
+					{
+						if (ec || !mSendRateTimerArmed)
+						{
+							return;
+						}
+
+						mSendRateTimerArmed = false;
+						onSendRateRefilled();
+					}));
+					return false;
+				}
+
+				void onSendRateRefilled()
+				{
+					if (!mSendRateResumed)
+					{
+						mSendRateResumed = true;
+						mThrottledNanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+							common::TokenBucket::Clock::now() - mThrottledSince).count(), std::memory_order_relaxed);
+					}
+					trySend();
+				}
+
+				void startSend(bool inlineWrite = false)
+				{
+					if (mSendRate.enabled() && (!hasSendMsg() || !acquireSendRate()))
+					{
+						return;
+					}
+
+					if (mSendingMsg.empty())
+					{
+						const auto lane = nextSendLane();
+						if (lane == nullptr)
+						{
+							return;
+						}
+						if (lane->head->isDirect())
+						{
+							mSendingMsg.pushBack(takePendingMsg(*lane));
+						}
+					}
+
+					if (!mSendingMsg.empty() && mSendingMsg.head->isDirect())
+					{
+						tryDirectSend();
+						return;
+					}
+
+					buildSendBuffers();
+
+					if (inlineWrite && mOption.inlineSend && sendInline())
+					{
+						// the rest, if any, goes the async way
+						startSend();
+						return;
 					}
 
 					mSending = true;
 					mSocket.async_send(mBuffers,
-						[self = shared_from_this(), this](std::error_code ec, size_t bytesTransferred)
+						asio::bind_executor(mStrand, [self = shared_from_this(), this](std::error_code ec, size_t bytesTransferred)
+					{
+						onSendCompleted(ec, bytesTransferred);
+					}));
+				}
+
+				// fills mBuffers with at most mOption.maxSendBuffers iovecs and sendBudget() bytes,
+				// consecutive tiny pieces are copied into the staging block and share one iovec
+				void buildSendBuffers()
+				{
+					mBuffers.clear();
+
+					size_t stagingUsed = 0;
+					bool stagingRun = false;
+					auto budget = sendBudget();
+					const auto collect = [&](const asio::const_buffer& wholePiece)
+					{
+						if (budget == 0)
+						{
+							return false;
+						}
+						const auto piece = asio::const_buffer(wholePiece.data(), std::min(wholePiece.size(), budget));
+						budget -= piece.size();
+
+						if (piece.size() < mOption.sendCoalesceThreshold &&
+							stagingUsed + piece.size() <= mOption.sendStagingSize &&
+							(stagingRun || mBuffers.size() < mOption.maxSendBuffers))
+						{
+							if (mSendStaging.empty())
+							{
+								mSendStaging.resize(mOption.sendStagingSize);
+							}
+
+							const auto staging = mSendStaging.data() + stagingUsed;
+							std::memcpy(staging, piece.data(), piece.size());
+							stagingUsed += piece.size();
+
+							if (stagingRun)
+							{
+								auto& last = mBuffers.back();
+								last = asio::const_buffer(last.data(), last.size() + piece.size());
+							}
+							else
+							{
+								mBuffers.emplace_back(staging, piece.size());
+								stagingRun = true;
+							}
+							return piece.size() == wholePiece.size();
+						}
+
+						if (mBuffers.size() >= mOption.maxSendBuffers)
+						{
+							return false;
+						}
+
+						mBuffers.push_back(piece);
+						stagingRun = false;
+						return piece.size() == wholePiece.size();
+					};
+
+					// a partially sent message goes first
+					if (!mSendingMsg.empty() && !mSendingMsg.head->pieces.visit(mSendingMsg.head->sendPos, collect))
+					{
+						return;
+					}
+
+					// then whole messages, taken from the highest lane first
+					for (auto lane = nextSendLane(); lane != nullptr && budget > 0; lane = nextSendLane())
+					{
+						// files and zerocopy messages go alone once everything before them is sent
+						if (lane->head->isDirect())
+						{
+							break;
+						}
+
+						const auto msg = takePendingMsg(*lane);
+						mSendingMsg.pushBack(msg);
+						if (!msg->pieces.visit(0, collect))
+						{
+							break;
+						}
+					}
+				}
+
+				// waits for writability, then writes the head message with a non-blocking syscall
+				void tryDirectSend()
+				{
+					mSending = true;
+					mSocket.async_wait(asio::socket_base::wait_write,
+						asio::bind_executor(mStrand, [self = shared_from_this(), this](std::error_code ec)
 					{
+						size_t bytesTransferred = 0;
+						if (!ec)
+						{
+							ec = mSendingMsg.head->isFile() ?
+								sendFileSome(*mSendingMsg.head, bytesTransferred) :
+								sendZeroCopySome(*mSendingMsg.head, bytesTransferred);
+						}
 						onSendCompleted(ec, bytesTransferred);
+					}));
+				}
+
+				std::error_code sendZeroCopySome(PendingMsg& msg, size_t& bytesTransferred)
+				{
+					mBuffers.clear();
+					auto budget = sendBudget();
+					msg.pieces.visit(msg.sendPos, [this, &budget](const asio::const_buffer& piece)
+					{
+						if (mBuffers.size() >= mOption.maxSendBuffers || budget == 0)
+						{
+							return false;
+						}
+						mBuffers.emplace_back(piece.data(), std::min(piece.size(), budget));
+						budget -= mBuffers.back().size();
+						return true;
 					});
+
+					// a call copied after ENOBUFS keeps the id of an earlier zerocopy call of the message
+					auto zeroCopied = false;
+					uint32_t id = 0;
+					const auto ec = mZeroCopy.send(mSocket.native_handle(), mBuffers.data(), mBuffers.size(), bytesTransferred, zeroCopied, id);
+					if (!ec && zeroCopied)
+					{
+						msg.zeroCopySent = true;
+						msg.zeroCopyId = id;
+					}
+					return ec;
 				}
 
-				void onSendCompleted(std::error_code ec, size_t bytesTransferred)
+				void tryWaitZeroCopyCompletion()
+				{
+					if (mZeroCopyWaiting || !mZeroCopy.hasRetained() || !mSocket.is_open())
+					{
+						return;
+					}
+
+					mZeroCopyWaiting = true;
+					mSocket.async_wait(asio::socket_base::wait_error,
+						asio::bind_executor(mStrand, [self = shared_from_this(), this](std::error_code ec)
+					{
+						mZeroCopyWaiting = false;
+						if (ec)
+						{
+							return;
+						}
+
+						mZeroCopy.readCompletions(mSocket.native_handle());
+						tryWaitZeroCopyCompletion();
+					}));
+				}
+
+				// non-blocking, stops at EAGAIN or after MaxSendFileChunkSize bytes / the send budget
+				std::error_code sendFileSome(const PendingMsg& msg, size_t& bytesTransferred)
+				{
+#if defined(_WIN32)
+					return asio::error::operation_not_supported;
+#else
+					const auto chunkSize = std::min(MaxSendFileChunkSize, sendBudget());
+#if defined(__linux__)
+					SigPipeGuard sigPipeGuard;
+#endif
+					while (bytesTransferred < chunkSize && msg.sendPos + bytesTransferred < msg.fileLength)
+					{
+						const auto pos = msg.sendPos + bytesTransferred;
+						const auto len = std::min<size_t>(msg.fileLength - pos, chunkSize - bytesTransferred);
+#if defined(__linux__)
+						off_t offset = static_cast<off_t>(msg.fileOffset + pos);
+						const auto n = ::sendfile(mSocket.native_handle(), msg.fileFd, &offset, len);
+#else
+						// no sendfile, read the region into the staging block, unsent bytes are read again next time
+						const auto stagingSize = std::max<size_t>(mOption.sendStagingSize, MinReceivePrepareSize);
+						if (mSendStaging.size() < stagingSize)
+						{
+							mSendStaging.resize(stagingSize);
+						}
+						auto n = ::pread(msg.fileFd, mSendStaging.data(), std::min(len, stagingSize),
+							static_cast<off_t>(msg.fileOffset + pos));
+						if (n > 0)
+						{
+#if defined(MSG_NOSIGNAL)
+							n = ::send(mSocket.native_handle(), mSendStaging.data(), n, MSG_NOSIGNAL);
+#else
+							// SO_NOSIGPIPE is set on the socket by asio where MSG_NOSIGNAL is missing
+							n = ::send(mSocket.native_handle(), mSendStaging.data(), n, 0);
+#endif
+						}
+#endif
+						if (n > 0)
+						{
+							bytesTransferred += n;
+							continue;
+						}
+						if (n == 0)
+						{
+							// file is shorter than the length to send
+							return asio::error::eof;
+						}
+						if (errno == EINTR)
+						{
+							continue;
+						}
+						if (errno == EAGAIN || errno == EWOULDBLOCK)
+						{
+							break;
+						}
+						return std::error_code(errno, asio::error::get_system_category());
+					}
+
+					return std::error_code();
+#endif
+				}
+
+				// nothing is in flight, writes mBuffers with a non-blocking writev right now
+				// instead of an async_send round trip through the io_context,
+				// returns false if nothing was written, the caller then goes the async way
+				bool sendInline()
+				{
+					asio::error_code ec;
+					const auto bytesTransferred = mSocket.send(mBuffers, 0, ec);
+					if (ec || bytesTransferred == 0)
+					{
+						// would_block, or an error which the async send reports again
+						return false;
+					}
+
+					accountSentBytes(bytesTransferred);
+					const auto completedMsg = adjustSendBuffer(bytesTransferred);
+					if (completedMsg == nullptr)
+					{
+						return true;
+					}
+
+					auto hasCallback = mSendAckHandler != nullptr;
+					for (auto msg = completedMsg; msg != nullptr && !hasCallback; msg = SendQueue::next(msg))
+					{
+						hasCallback = msg->callback != nullptr;
+					}
+					if (!hasCallback)
+					{
+						completeSentMsg(completedMsg);
+						return true;
+					}
+
+					// callbacks never run inside send, they may send again
+					std::unique_ptr<PendingMsg, PendingChainDeleter> completed(completedMsg);
+					asio::post(mStrand, [self = shared_from_this(), this, completed = std::move(completed)]()mutable
+					{
+						completeSentMsg(completed.release());
+					});
+					return true;
+				}
+
+				void accountSentBytes(size_t bytesTransferred) noexcept
 				{
-					std::vector<SendCompletedCallback> completedCallbacks;
+					mWriteDeficit -= std::min(mWriteDeficit, bytesTransferred);
+					if (mSendRate.enabled())
+					{
+						mSendRate.consume(bytesTransferred);
+					}
+					if (mSendRateResumed)
 					{
-						std::lock_guard<std::mutex> lck(mSendGuard);
-						mSending = false;
-						completedCallbacks = adjustSendBuffer(bytesTransferred);
+						mSendRateResumed = false;
+						mThrottledBytes.fetch_add(bytesTransferred, std::memory_order_relaxed);
 					}
+				}
+
+				void onSendCompleted(std::error_code ec, size_t bytesTransferred)
+				{
+					mSending = false;
+					accountSentBytes(bytesTransferred);
+					const auto completedMsg = adjustSendBuffer(bytesTransferred);
 
 					if (ec)
 					{
+						releasePendingMsg(completedMsg);
 						causeClosed();
 						return;
 					}
 
-					for (const auto& callback : completedCallbacks)
+					completeSentMsg(completedMsg);
+					flushSendQueue();
+				}
+
+				// runs the callbacks of a chain returned by adjustSendBuffer and recycles the messages
+				void completeSentMsg(PendingMsg* completedMsg)
+				{
+					// completed messages are already unlinked, callbacks may send again safely
+					for (auto msg = completedMsg; msg != nullptr;)
 					{
-						callback();
+						const auto nextMsg = SendQueue::next(msg);
+						if (msg->callback)
+						{
+							msg->callback();
+						}
+						if (msg->streamChunk)
+						{
+							msg->stream->outstanding -= msg->bytes();
+						}
+						if (msg->zeroCopySent)
+						{
+							mZeroCopy.retain(msg->zeroCopyId, std::move(msg->owner));
+						}
+						delete msg;
+						msg = nextMsg;
 					}
+					tryWaitZeroCopyCompletion();
 
-					trySend();
+					if (completedMsg != nullptr && mSendAckHandler != nullptr)
+					{
+						mSendAckHandler(shared_from_this(), mSentMessages, mSentBytes);
+					}
 				}
 
-				std::vector<SendCompletedCallback> adjustSendBuffer(size_t bytesTransferred)
+				// returns the completed messages, unlinked from mSendingMsg and still chained by mpscNext
+				// messages the write didn't reach go back to the front of their lanes, so a higher lane
+				// can still overtake them, only a partially sent one stays in mSendingMsg
+				PendingMsg* adjustSendBuffer(size_t bytesTransferred)
 				{
-					std::vector<SendCompletedCallback> completedCallbacks;
+					mQueuedBytes.fetch_sub(bytesTransferred, std::memory_order_relaxed);
+					mSentBytes += bytesTransferred;
 
-					while (bytesTransferred > 0)
+					PendingList completed;
+					while (!mSendingMsg.empty())
 					{
-						auto& frontMsg = mPendingSendMsg.front();
-						const auto len = std::min<size_t>(bytesTransferred, frontMsg.msg->size() - frontMsg.sendPos);
-						frontMsg.sendPos += len;
+						auto frontMsg = mSendingMsg.head;
+						const auto len = std::min<size_t>(bytesTransferred, frontMsg->bytes() - frontMsg->sendPos);
+						frontMsg->sendPos += len;
 						bytesTransferred -= len;
-						if (frontMsg.sendPos == frontMsg.msg->size())
+						if (frontMsg->sendPos != frontMsg->bytes())
 						{
-							if (frontMsg.callback)
-							{
-								completedCallbacks.push_back(std::move(frontMsg.callback));
-							}
-							mPendingSendMsg.pop_front();
+							break;
+						}
+
+						completed.pushBack(mSendingMsg.popFront());
+						mQueuedMessages.fetch_sub(1, std::memory_order_relaxed);
+						mSentMessages++;
+					}
+
+					auto unsent = mSendingMsg.head;
+					if (unsent != nullptr && unsent->sendPos > 0)
+					{
+						unsent = SendQueue::next(unsent);
+						mSendingMsg.head->mpscNext = nullptr;
+						mSendingMsg.tail = mSendingMsg.head;
+					}
+					else
+					{
+						mSendingMsg.release();
+					}
+
+					PendingList unsentLanes[SendLaneCount];
+					while (unsent != nullptr)
+					{
+						const auto nextMsg = SendQueue::next(unsent);
+						if (!requeueConflated(unsent))
+						{
+							unsentLanes[static_cast<size_t>(unsent->lane)].pushBack(unsent);
 						}
+						unsent = nextMsg;
+					}
+					for (size_t i = 0; i < SendLaneCount; i++)
+					{
+						mPendingSendMsg[i].prepend(unsentLanes[i]);
+					}
+
+					return completed.release();
+				}
+
+				// msg goes back to its lane, but a newer message with its key was queued meanwhile,
+				// returns true if msg is stale and deleted
+				bool requeueConflated(PendingMsg* msg)
+				{
+					if (msg->conflationKey == 0)
+					{
+						return false;
+					}
+
+					auto& slot = mConflation[static_cast<size_t>(msg->lane)][msg->conflationKey];
+					if (slot == nullptr)
+					{
+						slot = msg;
+						return false;
 					}
 
-					return completedCallbacks;
+					mQueuedBytes.fetch_sub(msg->bytes(), std::memory_order_relaxed);
+					mQueuedMessages.fetch_sub(1, std::memory_order_relaxed);
+					mConflatedMessages++;
+					delete msg;
+					return true;
+				}
+
+				static void releasePendingMsg(PendingMsg* msg) noexcept
+				{
+					while (msg != nullptr)
+					{
+						auto nextMsg = SendQueue::next(msg);
+						delete msg;
+						msg = nextMsg;
+					}
 				}
+
+				struct PendingChainDeleter
+				{
+					void operator()(PendingMsg* msg) const noexcept
+					{
+						releasePendingMsg(msg);
+					}
+				};
 			};
 
 			using TcpSessionEstablishHandler = std::function<void(TcpSession::Ptr)>;
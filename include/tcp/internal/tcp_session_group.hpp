@@ -0,0 +1,187 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <asio.hpp>
+
+#include <common/slab_pool.hpp>
+#include <tcp/internal/tcp_session.hpp>
+
+namespace gsio {
+	namespace tcp {
+		namespace internal {
+
+			// room / group of sessions
+			// members are sharded by the io_context they run on, a broadcast posts one task per io_context
+			// and that task hands the same ref-counted payload to the strand of every local member,
+			// so the calling thread pays per io_context, not per member
+			class TcpSessionGroup : public asio::noncopyable
+			{
+			private:
+				struct Shard
+				{
+					explicit Shard(asio::io_context& ioContext)
+						: context(ioContext), strand(ioContext.get_executor())
+					{}
+
+					asio::io_context& context;
+					asio::strand<asio::io_context::executor_type> strand;
+
+					// only accessed in strand
+					std::vector<TcpSession::Ptr> members;
+					std::unordered_map<TcpSession*, size_t> memberIndex;
+
+					bool add(const TcpSession::Ptr& session)
+					{
+						if (memberIndex.count(session.get()) != 0)
+						{
+							return false;
+						}
+						memberIndex[session.get()] = members.size();
+						members.push_back(session);
+						return true;
+					}
+
+					bool remove(TcpSession* session)
+					{
+						const auto it = memberIndex.find(session);
+						if (it == memberIndex.end())
+						{
+							return false;
+						}
+
+						const auto index = it->second;
+						memberIndex.erase(it);
+						if (index != members.size() - 1)
+						{
+							members[index] = std::move(members.back());
+							memberIndex[members[index].get()] = index;
+						}
+						members.pop_back();
+						return true;
+					}
+				};
+
+				std::mutex mShardsGuard;
+				// shards are only added, one per io_context
+				std::vector<std::shared_ptr<Shard>> mShards;
+				std::shared_ptr<std::atomic_size_t> mMemberCount;
+
+				TcpSessionGroup()
+					: mMemberCount(std::make_shared<std::atomic_size_t>(0))
+				{}
+
+			public:
+				using Ptr = std::shared_ptr<TcpSessionGroup>;
+
+				static Ptr Make()
+				{
+					class make_shared_enabler : public TcpSessionGroup
+					{};
+
+					return std::static_pointer_cast<TcpSessionGroup>(std::make_shared<make_shared_enabler>());
+				}
+
+				// thread safe, takes effect in the session's io_context
+				void join(const TcpSession::Ptr& session)
+				{
+					auto shard = shardOf(session->context());
+					asio::post(shard->strand, [shard, session, count = mMemberCount]()
+					{
+						if (shard->add(session))
+						{
+							count->fetch_add(1, std::memory_order_relaxed);
+						}
+					});
+				}
+
+				// thread safe, takes effect in the session's io_context
+				void leave(const TcpSession::Ptr& session)
+				{
+					auto shard = shardOf(session->context());
+					asio::post(shard->strand, [shard, session, count = mMemberCount]()
+					{
+						if (shard->remove(session.get()))
+						{
+							count->fetch_sub(1, std::memory_order_relaxed);
+						}
+					});
+				}
+
+				// approximate, joins / leaves still in flight are not counted
+				size_t size() const noexcept
+				{
+					return mMemberCount->load(std::memory_order_relaxed);
+				}
+
+				// pieces must stay immutable and alive as long as owner, they are shared by all members
+				// closed members are dropped from the group during the broadcast
+				template<typename ConstBufferSequence,
+					typename = typename std::enable_if<asio::is_const_buffer_sequence<ConstBufferSequence>::value>::type>
+				void broadcast(const ConstBufferSequence& pieces, TcpSession::SendOwner owner, const SendOptions& options = SendOptions())
+				{
+					const auto sendPieces = std::make_shared<const SendPieces>(pieces);
+
+					std::lock_guard<std::mutex> lck(mShardsGuard);
+					for (const auto& shard : mShards)
+					{
+						asio::post(shard->strand, [shard, sendPieces, owner, options, count = mMemberCount]()
+						{
+							for (size_t i = 0; i < shard->members.size();)
+							{
+								const auto& session = shard->members[i];
+								// the socket itself belongs to the session strand, sendInLoop checks it there
+								if (session->mClosed.load(std::memory_order_relaxed))
+								{
+									shard->remove(session.get());
+									count->fetch_sub(1, std::memory_order_relaxed);
+									continue;
+								}
+
+								asio::post(session->mStrand, [session, sendPieces, owner, options]()
+								{
+									session->sendInLoop(*sendPieces, owner, options);
+								});
+								i++;
+							}
+						});
+					}
+				}
+
+				void broadcast(std::shared_ptr<std::string> msg, const SendOptions& options = SendOptions())
+				{
+					const auto piece = asio::buffer(*msg);
+					broadcast(piece, std::move(msg), options);
+				}
+
+				void broadcast(common::SlabBuffer::Ptr buffer, const SendOptions& options = SendOptions())
+				{
+					const auto piece = asio::buffer(buffer->data(), buffer->size());
+					broadcast(piece, std::move(buffer), options);
+				}
+
+			private:
+				std::shared_ptr<Shard> shardOf(asio::io_context& ioContext)
+				{
+					std::lock_guard<std::mutex> lck(mShardsGuard);
+					for (const auto& shard : mShards)
+					{
+						if (&shard->context == &ioContext)
+						{
+							return shard;
+						}
+					}
+
+					mShards.push_back(std::make_shared<Shard>(ioContext));
+					return mShards.back();
+				}
+			};
+
+		}
+	}
+}
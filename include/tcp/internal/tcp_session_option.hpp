@@ -0,0 +1,160 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include <asio/detail/buffer_sequence_adapter.hpp>
+
+#include <tcp/internal/tcp_frame_codec.hpp>
+#include <tcp/internal/tcp_recv_buffer.hpp>
+#include <tcp/internal/tcp_recv_buffer_sizer.hpp>
+
+namespace gsio {
+	namespace tcp {
+		namespace internal {
+
+			class TcpSession;
+
+			// max iovec count asio hands to one writev, already bounded by IOV_MAX
+			const size_t MaxSendBuffers = asio::detail::buffer_sequence_adapter_base::max_buffers;
+
+			// called in io thread with one complete frame, the payload points into the receive buffer
+			// and is only valid during the call
+			using FrameHandler = std::function<void(std::shared_ptr<TcpSession>, const char*, size_t)>;
+
+			// called in io thread with the queued bytes / messages of the session
+			using SendWatermarkHandler = std::function<void(std::shared_ptr<TcpSession>, size_t, size_t)>;
+
+			// what to do with a session whose send queue stays above slowConsumerBytes for slowConsumerTimeout
+			enum class SlowConsumerPolicy
+			{
+				None,
+				// finish the message which has started sending, then shut down the send side and close,
+				// queued messages which haven't started sending are discarded,
+				// the connection is reset if that doesn't complete within another slowConsumerTimeout
+				Shutdown,
+				// reset the connection, unsent data is discarded by the kernel as well
+				Close,
+			};
+
+			// send lanes of a session, from the highest priority to the lowest
+			// a message of a higher lane goes out before any message of a lower lane which hasn't started sending,
+			// a message which has started is always finished first, so the byte stream framing is kept
+			enum class SendLane
+			{
+				// heartbeats, acks, input echoes
+				Control,
+				Bulk,
+			};
+			const size_t SendLaneCount = 2;
+
+			// per message options of TcpSession::send
+			struct SendOptions
+			{
+				SendLane lane = SendLane::Bulk;
+				// latest value wins, a queued message of the same lane and key which hasn't started sending
+				// is replaced in place by this one, e.g. the position of an entity, 0 disables
+				uint64_t conflationKey = 0;
+				// the message is dropped instead of sent once this passes, unless it has started sending,
+				// see TcpSession::expiredSendMessages, the default never expires
+				std::chrono::steady_clock::time_point deadline;
+			};
+
+			struct SendRateStats
+			{
+				// time a session had data to send but waited for its rate limit
+				uint64_t throttledNanoseconds;
+				// bytes written right after such a wait
+				uint64_t throttledBytes;
+			};
+
+			struct TcpSessionOption
+			{
+				// iovec count of one writev, clamped to [1, MaxSendBuffers]
+				size_t maxSendBuffers = MaxSendBuffers;
+				// pieces smaller than this are copied into the staging block,
+				// so a run of tiny messages costs only one iovec, 0 disables coalescing
+				size_t sendCoalesceThreshold = 128;
+				// size of the per-session staging block, allocated on first use
+				size_t sendStagingSize = 16 * 1024;
+				// sends issued in the io thread don't start a write right away but are flushed together
+				// at the end of the loop turn, or sendFlushDelay later, batching like Nagle without its ack wait
+				bool deferSendFlush = false;
+				std::chrono::microseconds sendFlushDelay{ 0 };
+				// a send in the io thread with nothing in flight writes at once with a non-blocking writev,
+				// only the rest goes through async_send, completion callbacks are still called later
+				bool inlineSend = true;
+
+				// highWatermarkHandler fires once the queued bytes or messages reach a high watermark,
+				// lowWatermarkHandler fires when the enabled ones drain to their low watermarks afterwards,
+				// a high watermark of 0 disables its dimension, the default low watermark means fully drained
+				size_t sendHighWatermarkBytes = 0;
+				size_t sendHighWatermarkMessages = 0;
+				size_t sendLowWatermarkBytes = 0;
+				size_t sendLowWatermarkMessages = 0;
+				SendWatermarkHandler highWatermarkHandler;
+				SendWatermarkHandler lowWatermarkHandler;
+
+				SlowConsumerPolicy slowConsumerPolicy = SlowConsumerPolicy::None;
+				size_t slowConsumerBytes = 0;
+				std::chrono::nanoseconds slowConsumerTimeout = std::chrono::seconds(10);
+
+				// TcpSession::sendStream pulls the next chunk while less than this many bytes of the stream are queued
+				size_t streamPullThreshold = 256 * 1024;
+
+				// bytes a session may write per turn of the deficit round robin among the sessions of its io_context,
+				// a session with a large backlog then waits behind the others instead of writing again at once,
+				// 0 disables scheduling, every write is started as soon as the previous one completes
+				size_t writeQuantum = 0;
+
+				// egress token bucket in bytes per second, 0 disables, burst 0 means 100ms worth of rate
+				// with sendPacing the kernel paces the packets instead (SO_MAX_PACING_RATE, linux only),
+				// the token bucket is used where that isn't available
+				size_t sendRateLimit = 0;
+				size_t sendRateBurst = 0;
+				bool sendPacing = false;
+
+				// sizing policy of the receive buffer, empty keeps the tanh growth (TanhRecvBufferSizer),
+				// AdaptiveRecvBufferSizer::Factory() also shrinks and gives memory back after a burst
+				RecvBufferSizerFactory recvBufferSizer;
+				// storage of the receive buffer, empty means asio::streambuf (StreambufRecvBuffer),
+				// MirroredRecvBuffer::Factory() never moves partial messages to the front (linux only)
+				RecvBufferFactory recvBuffer;
+				// wait for readability instead of keeping a receive posted, then read into a scratch buffer
+				// of the io thread, a buffer of the session only exists while a partial message is kept,
+				// for huge numbers of mostly idle connections
+				bool recvOnReadable = false;
+				// after a read which filled its buffer, keep reading without going back to the io_context
+				// until the socket has nothing left, at most recvDrainBytes and recvDrainReads per wakeup,
+				// so one busy connection doesn't starve the others of its io thread, 0 bytes disables
+				size_t recvDrainBytes = 0;
+				size_t recvDrainReads = 16;
+				// a session caught up with its peer for this long gives the receive buffer of a past burst back,
+				// 0 keeps it for the next burst
+				std::chrono::milliseconds recvIdleReclaim{ 100 };
+				// reading pauses once TcpSession::pendingRecvWork reaches recvPauseWork
+				// and resumes when it's down to recvResumeWork again, 0 disables
+				size_t recvPauseWork = 0;
+				size_t recvResumeWork = 0;
+				// when the data handler (TcpSession::needRecvBytes) or the frame codec needs at least this many
+				// more bytes, SO_RCVLOWAT keeps the socket unreadable until they arrived, 0 disables
+				// the next receive is sized for the needed bytes either way
+				size_t recvLowWatermarkThreshold = 0;
+
+				// with a headerSize and a frameHandler, received bytes are split into length prefixed frames
+				// which go to frameHandler instead of the data handler, the receive buffer may grow to
+				// headerSize + maxFrameSize even above the max receive buffer size of the session
+				FrameCodecOption frameCodec;
+				FrameHandler frameHandler;
+
+				// messages of at least this size are sent with MSG_ZEROCOPY (linux only), 0 disables,
+				// their owner is kept until the kernel reports the pages are no longer used
+				size_t zeroCopyThreshold = 0;
+			};
+
+		}
+	}
+}
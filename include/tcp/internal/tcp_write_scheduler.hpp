@@ -0,0 +1,91 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include <asio.hpp>
+
+namespace gsio {
+	namespace tcp {
+		namespace internal {
+
+			// deficit round robin over the sessions of one io_context which have something to write
+			// a ready session waits for its turn instead of writing again right after its last write completed,
+			// every turn it gets its quantum of bytes added to its deficit and writes at most the deficit,
+			// so one huge backlog can't hold the io thread while thousands of other sessions wait
+			// thread safe, several threads may run the context, every turn runs in the strand of its session
+			template<typename Session>
+			class TcpWriteScheduler : public asio::execution_context::service
+			{
+			private:
+				asio::io_context& mIoContext;
+				std::mutex mReadyGuard;
+				std::deque<std::shared_ptr<Session>> mReady;
+				bool mRoundPosted{ false };
+
+			public:
+				static asio::execution_context::id id;
+
+				explicit TcpWriteScheduler(asio::execution_context& context)
+					: asio::execution_context::service(context),
+					mIoContext(static_cast<asio::io_context&>(context))
+				{}
+
+				static TcpWriteScheduler& Of(asio::io_context& ioContext)
+				{
+					return asio::use_service<TcpWriteScheduler>(ioContext);
+				}
+
+				// session gets one turn in the next round
+				void schedule(std::shared_ptr<Session> session)
+				{
+					std::lock_guard<std::mutex> lck(mReadyGuard);
+					mReady.push_back(std::move(session));
+					if (mRoundPosted)
+					{
+						return;
+					}
+
+					mRoundPosted = true;
+					asio::post(mIoContext, [this]()
+					{
+						runRound();
+					});
+				}
+
+			private:
+				void shutdown() override
+				{
+					// sessions hold their socket, release them before the reactor goes away
+					std::lock_guard<std::mutex> lck(mReadyGuard);
+					mReady.clear();
+				}
+
+				// sessions scheduled during the round, e.g. by their own write completion, wait for the next one,
+				// which is posted behind the completion handlers and turns already queued
+				void runRound()
+				{
+					std::deque<std::shared_ptr<Session>> round;
+					{
+						std::lock_guard<std::mutex> lck(mReadyGuard);
+						mRoundPosted = false;
+						round.swap(mReady);
+					}
+
+					for (auto& session : round)
+					{
+						asio::post(session->mStrand, [session]()
+						{
+							session->onWriteTurn();
+						});
+					}
+				}
+			};
+
+			template<typename Session>
+			asio::execution_context::id TcpWriteScheduler<Session>::id;
+
+		}
+	}
+}
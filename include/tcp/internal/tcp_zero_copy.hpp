@@ -0,0 +1,238 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
+
+#include <tcp/internal/tcp_session_option.hpp>
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define GSIO_HAS_ZEROCOPY 1
+#else
+#define GSIO_HAS_ZEROCOPY 0
+#endif
+
+namespace gsio {
+	namespace tcp {
+		namespace internal {
+
+			struct ZeroCopyStats
+			{
+				// sendmsg calls made with MSG_ZEROCOPY
+				uint64_t sent;
+				// calls the kernel reported as copied anyway, e.g. on loopback
+				uint64_t copied;
+			};
+
+			// MSG_ZEROCOPY bookkeeping of one socket
+			// every successful zerocopy sendmsg gets the next 32 bit id, the kernel reports finished id ranges
+			// on the error queue, the owner of a message is only released once all its ids are finished
+			class ZeroCopyTracker
+			{
+			private:
+				uint32_t mNextId{ 0 };
+				// all ids before this one are finished
+				uint32_t mFinished{ 0 };
+				std::vector<std::pair<uint32_t, uint32_t>> mOutOfOrderRanges;
+				std::deque<std::pair<uint32_t, std::shared_ptr<void>>> mRetained;
+
+				std::atomic<uint64_t> mSent{ 0 };
+				std::atomic<uint64_t> mCopied{ 0 };
+
+				// wrap-around safe a < b
+				static bool before(uint32_t a, uint32_t b) noexcept
+				{
+					return static_cast<int32_t>(a - b) < 0;
+				}
+
+			public:
+				static bool enable(int fd) noexcept
+				{
+#if GSIO_HAS_ZEROCOPY
+					const int one = 1;
+					return ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#else
+					(void)fd;
+					return false;
+#endif
+				}
+
+				// non-blocking, bytesTransferred stays 0 on EAGAIN
+				// zeroCopied and id are only set when the kernel took the data by reference,
+				// not when it was copied after ENOBUFS
+				std::error_code send(int fd, const asio::const_buffer* buffers, size_t count,
+					size_t& bytesTransferred, bool& zeroCopied, uint32_t& id) noexcept
+				{
+#if GSIO_HAS_ZEROCOPY
+					iovec iov[MaxSendBuffers];
+					count = std::min<size_t>(count, sizeof(iov) / sizeof(iov[0]));
+					for (size_t i = 0; i < count; i++)
+					{
+						iov[i].iov_base = const_cast<void*>(buffers[i].data());
+						iov[i].iov_len = buffers[i].size();
+					}
+
+					msghdr msg{};
+					msg.msg_iov = iov;
+					msg.msg_iovlen = count;
+
+					auto flags = MSG_ZEROCOPY | MSG_NOSIGNAL | MSG_DONTWAIT;
+					for (;;)
+					{
+						const auto n = ::sendmsg(fd, &msg, flags);
+						if (n >= 0)
+						{
+							bytesTransferred = n;
+							if ((flags & MSG_ZEROCOPY) != 0)
+							{
+								zeroCopied = true;
+								id = mNextId++;
+								mSent.fetch_add(1, std::memory_order_relaxed);
+							}
+							return std::error_code();
+						}
+						if (errno == EINTR)
+						{
+							continue;
+						}
+						if (errno == EAGAIN || errno == EWOULDBLOCK)
+						{
+							return std::error_code();
+						}
+						if (errno == ENOBUFS && (flags & MSG_ZEROCOPY) != 0)
+						{
+							// optmem limit reached by outstanding notifications, copy this time
+							flags &= ~MSG_ZEROCOPY;
+							continue;
+						}
+						return std::error_code(errno, asio::error::get_system_category());
+					}
+#else
+					(void)fd;
+					(void)buffers;
+					(void)count;
+					(void)bytesTransferred;
+					(void)zeroCopied;
+					(void)id;
+					return asio::error::operation_not_supported;
+#endif
+				}
+
+				// owner is released once the kernel reports lastId finished
+				void retain(uint32_t lastId, std::shared_ptr<void> owner)
+				{
+					if (before(lastId, mFinished))
+					{
+						return;
+					}
+					mRetained.emplace_back(lastId, std::move(owner));
+				}
+
+				bool hasRetained() const noexcept
+				{
+					return !mRetained.empty();
+				}
+
+				// drains the error queue without blocking
+				void readCompletions(int fd) noexcept
+				{
+#if GSIO_HAS_ZEROCOPY
+					for (;;)
+					{
+						char control[128];
+						msghdr msg{};
+						msg.msg_control = control;
+						msg.msg_controllen = sizeof(control);
+
+						if (::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+						{
+							if (errno == EINTR)
+							{
+								continue;
+							}
+							break;
+						}
+
+						for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+						{
+							if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+								(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
+							{
+								continue;
+							}
+
+							const auto err = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+							if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+							{
+								continue;
+							}
+
+							if ((err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0)
+							{
+								mCopied.fetch_add(err->ee_data - err->ee_info + 1, std::memory_order_relaxed);
+							}
+							onFinished(err->ee_info, err->ee_data);
+						}
+					}
+#else
+					(void)fd;
+#endif
+				}
+
+				ZeroCopyStats stats() const noexcept
+				{
+					return { mSent.load(std::memory_order_relaxed), mCopied.load(std::memory_order_relaxed) };
+				}
+
+			private:
+				// ids [low, high] are finished
+				void onFinished(uint32_t low, uint32_t high)
+				{
+					if (before(mFinished, low))
+					{
+						mOutOfOrderRanges.emplace_back(low, high);
+						return;
+					}
+					if (!before(high, mFinished))
+					{
+						mFinished = high + 1;
+					}
+
+					for (auto it = mOutOfOrderRanges.begin(); it != mOutOfOrderRanges.end();)
+					{
+						if (before(mFinished, it->first))
+						{
+							++it;
+							continue;
+						}
+						if (!before(it->second, mFinished))
+						{
+							mFinished = it->second + 1;
+						}
+						mOutOfOrderRanges.erase(it);
+						it = mOutOfOrderRanges.begin();
+					}
+
+					while (!mRetained.empty() && before(mRetained.front().first, mFinished))
+					{
+						mRetained.pop_front();
+					}
+				}
+			};
+
+		}
+	}
+}
@@ -6,6 +6,7 @@
 #include <asio.hpp>
 
 #include <tcp/internal/tcp_session.hpp>
+#include <tcp/internal/tcp_session_group.hpp>
 #include <tcp/internal/tcp_acceptor.hpp>
 #include <tcp/internal/tcp_connector.hpp>
 #include <common/io_context_thread_pool.hpp>
@@ -14,6 +15,15 @@ namespace gsio {
 	namespace tcp {
 
 		using SessionPtr = internal::TcpSession::Ptr;
+		using SessionGroup = internal::TcpSessionGroup;
+		using SlowConsumerPolicy = internal::SlowConsumerPolicy;
+		using ZeroCopyStats = internal::ZeroCopyStats;
+		using SendRateStats = internal::SendRateStats;
+		using SendLane = internal::SendLane;
+		using SendOptions = internal::SendOptions;
+		using FrameByteOrder = internal::FrameByteOrder;
+		using FrameCodecOption = internal::FrameCodecOption;
+		using FrameCodec = internal::FrameCodec;
 
 		class TcpServerService
 		{
@@ -22,6 +32,14 @@ namespace gsio {
 			virtual void onConnected(SessionPtr session) = 0;
 			virtual size_t dataHandler(SessionPtr session, const char* data, size_t size) = 0;
 			virtual void onClosed(SessionPtr session) = 0;
+
+			// send queue of session reaches the high watermark / drains to the low watermark
+			virtual void onSendHighWatermark(SessionPtr /*session*/, size_t /*queuedBytes*/, size_t /*queuedMessages*/) {}
+			virtual void onSendLowWatermark(SessionPtr /*session*/, size_t /*queuedBytes*/, size_t /*queuedMessages*/) {}
+
+			// one complete frame with TcpServer::WithFrameCodec, dataHandler isn't called then
+			// data points into the receive buffer and is only valid during the call
+			virtual void onFrame(SessionPtr /*session*/, const char* /*data*/, size_t /*size*/) {}
 		};
 
 		class TcpClientService : public TcpServerService
@@ -42,6 +60,7 @@ namespace gsio {
 
 			// session about 
 			size_t mRecvBufferSize{ 1024 };
+			internal::TcpSessionOption mSessionOption;
 
 		public:
 			TcpServer(int port, size_t poolSize, int concurrencyHint)
@@ -60,12 +79,142 @@ namespace gsio {
 				return *this;
 			}
 
+			// max iovec count of one writev, clamped to IOV_MAX / asio limit
+			TcpServer& WithMaxSendBuffers(size_t count) noexcept
+			{
+				mSessionOption.maxSendBuffers = count;
+				return *this;
+			}
+
+			// messages smaller than threshold are copied into a staging block of stagingSize,
+			// so a flood of tiny messages goes out with few iovecs, threshold 0 disables it
+			TcpServer& WithSendCoalesce(size_t threshold, size_t stagingSize) noexcept
+			{
+				mSessionOption.sendCoalesceThreshold = threshold;
+				mSessionOption.sendStagingSize = stagingSize;
+				return *this;
+			}
+
+			// bytes / messages of 0 are disabled
+			TcpServer& WithSendHighWatermark(size_t bytes, size_t messages) noexcept
+			{
+				mSessionOption.sendHighWatermarkBytes = bytes;
+				mSessionOption.sendHighWatermarkMessages = messages;
+				return *this;
+			}
+
+			TcpServer& WithSendLowWatermark(size_t bytes, size_t messages) noexcept
+			{
+				mSessionOption.sendLowWatermarkBytes = bytes;
+				mSessionOption.sendLowWatermarkMessages = messages;
+				return *this;
+			}
+
+			// applies policy to sessions whose queued bytes stay above bytes for timeout
+			TcpServer& WithSlowConsumerPolicy(internal::SlowConsumerPolicy policy, size_t bytes, std::chrono::nanoseconds timeout) noexcept
+			{
+				mSessionOption.slowConsumerPolicy = policy;
+				mSessionOption.slowConsumerBytes = bytes;
+				mSessionOption.slowConsumerTimeout = timeout;
+				return *this;
+			}
+
+			// sends of one loop turn (plus delay) go out in one writev
+			TcpServer& WithDeferredSendFlush(std::chrono::microseconds delay = std::chrono::microseconds(0)) noexcept
+			{
+				mSessionOption.deferSendFlush = true;
+				mSessionOption.sendFlushDelay = delay;
+				return *this;
+			}
+
+			// fair write scheduling among the sessions of one io thread, at most quantum bytes per session per turn
+			TcpServer& WithWriteQuantum(size_t quantum) noexcept
+			{
+				mSessionOption.writeQuantum = quantum;
+				return *this;
+			}
+
+			// egress limit of every session, see TcpSession::asyncSetSendRateLimit for a single one
+			TcpServer& WithSendRateLimit(size_t bytesPerSecond, size_t burst = 0, bool pacing = false) noexcept
+			{
+				mSessionOption.sendRateLimit = bytesPerSecond;
+				mSessionOption.sendRateBurst = burst;
+				mSessionOption.sendPacing = pacing;
+				return *this;
+			}
+
+			TcpServer& WithRecvBufferSizer(internal::RecvBufferSizerFactory factory) noexcept
+			{
+				mSessionOption.recvBufferSizer = std::move(factory);
+				return *this;
+			}
+
+			TcpServer& WithRecvBuffer(internal::RecvBufferFactory factory) noexcept
+			{
+				mSessionOption.recvBuffer = std::move(factory);
+				return *this;
+			}
+
+			TcpServer& WithRecvOnReadable(bool recvOnReadable = true) noexcept
+			{
+				mSessionOption.recvOnReadable = recvOnReadable;
+				return *this;
+			}
+
+			// keep reading a busy socket for up to bytes / reads per wakeup before yielding to the other sessions
+			TcpServer& WithRecvDrain(size_t bytes, size_t reads = 16) noexcept
+			{
+				mSessionOption.recvDrainBytes = bytes;
+				mSessionOption.recvDrainReads = reads;
+				return *this;
+			}
+
+			// idle sessions give the receive buffer of a past burst back after timeout, 0 keeps it
+			TcpServer& WithRecvIdleReclaim(std::chrono::milliseconds timeout) noexcept
+			{
+				mSessionOption.recvIdleReclaim = timeout;
+				return *this;
+			}
+
+			// sessions stop reading while their pending work (TcpSession::addRecvWork) is at pauseWork or above,
+			// until it drops to resumeWork
+			TcpServer& WithRecvWorkLimit(size_t pauseWork, size_t resumeWork) noexcept
+			{
+				mSessionOption.recvPauseWork = pauseWork;
+				mSessionOption.recvResumeWork = resumeWork;
+				return *this;
+			}
+
+			// partial messages missing at least threshold bytes wake the session up once instead of per segment
+			TcpServer& WithRecvLowWatermark(size_t threshold) noexcept
+			{
+				mSessionOption.recvLowWatermarkThreshold = threshold;
+				return *this;
+			}
+
+			// messages of at least threshold bytes are sent with MSG_ZEROCOPY, 0 disables
+			TcpServer& WithZeroCopyThreshold(size_t threshold) noexcept
+			{
+				mSessionOption.zeroCopyThreshold = threshold;
+				return *this;
+			}
+
+			// length prefixed framing, see FrameCodecOption, FrameCodec::header builds the header of a reply
+			TcpServer& WithFrameCodec(size_t headerSize, FrameByteOrder byteOrder, size_t maxFrameSize) noexcept
+			{
+				mSessionOption.frameCodec.headerSize = headerSize;
+				mSessionOption.frameCodec.byteOrder = byteOrder;
+				mSessionOption.frameCodec.maxFrameSize = maxFrameSize;
+				return *this;
+			}
+
 			TcpServer& WithService(std::shared_ptr<TcpServerService> service) noexcept
 			{
 				mService = std::move(service);
 				return *this;
 			}
 
+			// thread_num_per_context threads run every session io_context, the handlers of one session never run concurrently
 			void Start(size_t thread_num_per_context)
 			{
 				if (mAcceptor == nullptr)
@@ -80,6 +229,15 @@ namespace gsio {
 				auto dataHandler = std::bind(&TcpServerService::dataHandler, 
 					mService, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
 				auto closeHandler = std::bind(&TcpServerService::onClosed, mService, std::placeholders::_1);
+				mSessionOption.highWatermarkHandler = std::bind(&TcpServerService::onSendHighWatermark,
+					mService, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+				mSessionOption.lowWatermarkHandler = std::bind(&TcpServerService::onSendLowWatermark,
+					mService, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+				if (mSessionOption.frameCodec.headerSize > 0)
+				{
+					mSessionOption.frameHandler = std::bind(&TcpServerService::onFrame,
+						mService, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+				}
 
 				mAcceptorIoContext.start(1);
 				mSessionIoContextThreadPool->start(thread_num_per_context);
@@ -87,7 +245,7 @@ namespace gsio {
 				mAcceptor->startAccept([=](asio::ip::tcp::socket socket)
 					{
 						mService->onRawSocket(socket);
-						mService->onConnected(internal::TcpSession::Make(std::move(socket), mRecvBufferSize, dataHandler, closeHandler));
+						mService->onConnected(internal::TcpSession::Make(std::move(socket), mRecvBufferSize, dataHandler, closeHandler, mSessionOption));
 					});
 			}
 